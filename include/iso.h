@@ -6,9 +6,52 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
 #include <stdio.h>
-
-#define JOLIET_OFFSET 0x8800
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define DESC_SET_LBA 16
+#define DESC_SECTOR_SIZE 0x800
+#define DESC_SCAN_NUM 8
+#define DESC_SET_MAX 64
+#define DESC_TYPE_BOOT 0
+#define DESC_TYPE_PRIMARY 1
+#define DESC_TYPE_SUPPLEMENTARY 2
+#define DESC_TYPE_PARTITION 3
+#define DESC_TYPE_TERMINATOR 255
+#define ARENA_CHUNK_SIZE 0x4000
+#define INDEX_ROOT 0
+#define COPY_CHUNK_SIZE 0x10000
+#define DIR_WINDOW_SIZE 0x100000
+#define BATCH_CHUNK_SIZE 0x10000
+#define URING_DEPTH 64
+#define URING_READ_MAX 0x40000000
+#define ENTRY_HIDDEN 0x01
+#define ENTRY_MULTI_EXTENT 0x02
+#define RR_MAX_CE 16
+#define CACHE_SLOT_SIZE 0x800
+#define CACHE_NIL UINT32_MAX
+#define INDEX_MAGIC "IMNIDX01"
+#define INDEX_VERSION 3
+#define INDEX_ENDIAN_TAG 0x01020304
+#define RR_TIME_CREATE 0x01
+#define RR_TIME_MODIFY 0x02
+#define RR_TIME_ACCESS 0x04
+#define RR_TIME_ATTRIB 0x08
+#define ZISO_MAGIC "\x37\xE4\x53\x96\xC9\xDB\xD6\x07"
+#define ZISO_HEADER_SIZE 16
+#define ZISO_LOG2_MIN 15
+#define ZISO_LOG2_MAX 17
+#define ZISO_CACHE_NUM 4
+#define PIPE_STAGE_MAX 8
+#define PIPE_CHUNK_SIZE 0x40000
+#define PIPE_DEPTH 3
+#define HASH_CRC32 0x01
+#define HASH_SHA256 0x02
+#define HASH_RUN_SIZE 0x400000
+#define HASH_GAP_MAX 0x10000
+#define SHA256_DIGEST_SIZE 32
 #define BP(a,b) [(b) - (a) + 1]
 
 /**** Raw ISO-9660 Structs ****/
@@ -22,7 +65,7 @@ typedef struct {
     uint8_t volume_id                BP(41, 72);
     uint8_t unused2                  BP(73, 80);
     uint8_t vol_space_size           BP(81, 88);
-    uint8_t unused3                  BP(89, 120);
+    uint8_t escape_sequences         BP(89, 120);
     uint8_t vol_set_size             BP(121, 124);
     uint8_t vol_seq_number           BP(125, 128);
     uint8_t block_size               BP(129, 132);
@@ -81,13 +124,25 @@ typedef struct {
 
 } imn_range_t;
 
-typedef struct linked_path_s {
+typedef struct {
+
+    uint32_t lba;
+    uint32_t parent;
 
+    uint32_t name_offset;
     uint32_t id_length;
-    char *record_id;
-    struct linked_path_s *link;
 
-} imn_cpath_t;
+} imn_pt_entry_t;
+
+typedef struct {
+
+    char *buffer;
+    size_t length;
+    size_t cap;
+
+    struct imn_path_callback_s *callback;
+
+} imn_path_buf_t;
 
 typedef struct {
 
@@ -96,6 +151,72 @@ typedef struct {
 
 } imn_string_t;
 
+typedef struct arena_chunk_s {
+
+    size_t size;
+    size_t used;
+    struct arena_chunk_s *link;
+
+} imn_arena_chunk_t;
+
+typedef struct {
+
+    imn_arena_chunk_t *chunk;
+    imn_arena_chunk_t *spare;
+
+    // Chunk mallocs are charged to the owning handle's counters
+    struct imn_stats_s *stats;
+
+} imn_arena_t;
+
+typedef struct {
+
+    imn_arena_chunk_t *chunk;
+    size_t used;
+
+} imn_arena_mark_t;
+
+typedef struct {
+
+    uint32_t lba;
+    uint32_t block_num;
+    uint32_t block_cap;
+    uint32_t window_end;
+    bool is_loaded;
+
+    uint16_t block_size;
+    uint8_t *data;
+    uint8_t *storage;
+
+} imn_block_buf_t;
+
+#ifdef IMN_IO_URING
+typedef struct {
+
+    int ring_fd;
+    unsigned sq_entries;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+} imn_uring_t;
+#endif
+
 typedef struct {
     
     imn_raw_record_t *raw_rec;
@@ -106,6 +227,53 @@ typedef struct {
 
 } imn_rawrec_wrapper_t;
 
+typedef struct {
+
+    // Continuation area announced by the last CE entry
+    bool has_ce;
+    uint32_t ce_lba;
+    uint32_t ce_offset;
+    uint32_t ce_length;
+
+    size_t name_cap;
+    bool name_done;
+
+    size_t link_cap;
+    bool link_done;
+    bool link_join;
+
+} imn_susp_state_t;
+
+// Sidecar layout: header, then 8-byte aligned sections at the given offsets
+typedef struct {
+
+    char magic[8];
+    uint32_t version;
+    uint32_t endian_tag;
+
+    uint64_t image_size;
+    int64_t image_mtime;
+    uint64_t desc_hash;
+
+    // Descriptor the tree was read from; other descriptors need their own
+    uint32_t desc_idx;
+    uint32_t reserved;
+
+    uint64_t entry_num;
+    uint64_t extent_num;
+    uint64_t pool_size;
+    uint64_t hash_size;
+
+    // FNV-1a over the four sections, in order
+    uint64_t checksum;
+
+    uint64_t entries_offset;
+    uint64_t extents_offset;
+    uint64_t pool_offset;
+    uint64_t hash_offset;
+
+} imn_index_header_t;
+
 
 /**** API Structs ****/
 
@@ -144,25 +312,111 @@ typedef struct imn_record_t {
 
 } imn_record_t;
 
+typedef struct {
+
+    uint32_t lba;
+    uint8_t type;
+    uint8_t version;
+
+    // 1-3 for Joliet SVDs (escape sequence %/@, %/C, %/E); 0 otherwise
+    uint8_t joliet_level;
+
+} imn_desc_entry_t;
+
 typedef struct {
     uint32_t lba_size;
     uint16_t block_size;
 
+    uint32_t desc_idx;
+    uint8_t joliet_level;
+
+    // SUSP detected through the SP entry of the root's "." record
+    bool has_susp;
+    uint8_t susp_skip;
+
     imn_record_t *root_dir;
 
     uint32_t path_table_size;
     uint32_t path_table_lba;
 
+    imn_pt_entry_t *pt_list;
+    uint32_t pt_num;
+    char *pt_names;
+
 } imn_vol_desc_t;
 
 typedef struct {
 	imn_vol_desc_t *desc;
 
     bool is_header;
-	FILE *iso_file;
+
+    // -1 for mmap handles; only ever read through pread
+    int iso_fd;
+
+    uint8_t *iso_map;
+    size_t map_size;
+
+    imn_desc_entry_t *desc_list;
+    uint32_t desc_num;
+
+    // Identity of the opened image; keys persisted indexes
+    uint64_t image_size;
+    int64_t image_mtime;
+    uint64_t desc_hash;
+
+    // Handles of the same image share entries through image_key
+    struct imn_cache_s *cache;
+    uint64_t image_key;
+
+    // Both optional; NULL costs one branch per instrumented site
+    struct imn_stats_s *stats;
+    struct imn_trace_s *trace;
+
+#ifdef IMN_IO_URING
+    // Set up by the first batch; batches that find it busy use pread
+    pthread_mutex_t ring_lock;
+    imn_uring_t *ring;
+    bool ring_failed;
+#endif
 
 } imn_iso_t;
 
+// Rock Ridge attributes; names and link targets are malloc'd
+typedef struct {
+
+    bool has_px;
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t ino;
+
+    bool has_pn;
+    uint64_t dev;
+
+    char *name;
+    size_t name_length;
+
+    char *link_target;
+    size_t link_length;
+
+    uint8_t time_flags;
+    time_t create_time;
+    time_t modify_time;
+    time_t access_time;
+    time_t attrib_time;
+
+    bool is_relocated;
+    uint32_t child_lba;
+    uint32_t parent_lba;
+
+    // zisofs ("pz") file; imn_open decompresses these transparently
+    bool has_zf;
+    uint8_t zf_block_log2;
+    uint32_t zf_size;
+
+} imn_rr_attr_t;
+
 typedef struct {
 
     int (*fn)(imn_record_t *, void *);
@@ -170,6 +424,153 @@ typedef struct {
 
 } imn_callback_t;
 
+// path is NUL-terminated and only valid for the duration of the call
+typedef struct imn_path_callback_s {
+
+    int (*fn)(imn_record_t *, char *path, size_t path_len, void *);
+    void *args;
+
+} imn_path_callback_t;
+
+typedef struct {
+
+    imn_iso_t *iso;
+    imn_record_t *dir_record;
+
+    imn_extent_t *cur_extent;
+    imn_range_t range;
+
+    imn_block_buf_t block_buf;
+    imn_arena_t arena;
+    imn_arena_mark_t entry_mark;
+    imn_record_t record;
+
+} imn_dir_t;
+
+// Struct-of-arrays view over one batch; all entries share dir_record
+typedef struct {
+
+    imn_record_t *dir_record;
+    uint32_t entry_num;
+    uint32_t entry_cap;
+
+    uint32_t *lba_list;
+    uint64_t *size_list;
+    uint8_t *flag_list;
+
+    uint32_t *name_offsets;
+    uint32_t *name_lengths;
+    char *name_pool;
+    size_t pool_used;
+    size_t pool_size;
+
+} imn_entry_batch_t;
+
+typedef struct {
+
+    int (*fn)(imn_entry_batch_t *, void *);
+    void *args;
+
+} imn_batch_callback_t;
+
+typedef struct {
+
+    off_t disk_offset;
+    off_t rel_offset;
+    off_t length;
+
+} imn_file_span_t;
+
+// zisofs block table plus a few decompressed blocks for sequential readers
+typedef struct {
+
+    pthread_mutex_t lock;
+
+    uint32_t *block_ptrs;
+    uint32_t block_num;
+    uint32_t block_size;
+
+    uint8_t *comp_buf;
+    size_t comp_cap;
+
+    uint8_t *cache_data;
+    uint32_t cache_blocks[ZISO_CACHE_NUM];
+    uint32_t cache_next;
+
+} imn_ziso_t;
+
+typedef struct {
+
+    imn_iso_t *iso;
+
+    imn_file_span_t *span_list;
+    uint32_t span_num;
+
+    // total_size is the decompressed size; raw_size what is on disk
+    off_t total_size;
+    off_t raw_size;
+    off_t position;
+
+    imn_ziso_t *ziso;
+
+    // Optional transforms applied to everything read through the file
+    struct imn_pipeline_s *pipeline;
+    struct imn_chunk_cache_s *chunk_cache;
+
+} imn_file_t;
+
+typedef struct {
+
+    uint32_t lba_offset;
+    uint32_t data_length;
+
+} imn_index_extent_t;
+
+typedef struct {
+
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t child_num;
+
+    uint32_t first_extent;
+    uint32_t extent_num;
+
+    uint32_t name_offset;
+    uint32_t id_length;
+
+    uint64_t total_size;
+
+    // Stored as bytes and checked on load; bool has no fixed encoding
+    uint8_t is_hidden;
+    uint8_t is_dir;
+
+} imn_index_entry_t;
+
+typedef struct {
+
+    imn_index_entry_t *entries;
+    size_t entry_num;
+    size_t entry_cap;
+
+    imn_index_extent_t *extents;
+    size_t extent_num;
+    size_t extent_cap;
+
+    char *name_pool;
+    size_t pool_size;
+    size_t pool_cap;
+
+    uint32_t *hash_slots;
+    size_t hash_size;
+
+    uint32_t desc_idx;
+
+    // Set when loaded from a sidecar; arrays then point into the mapping
+    void *index_map;
+    size_t map_size;
+
+} imn_index_t;
+
 
 /**** API Errors ****/
 
@@ -191,23 +592,487 @@ typedef enum {
 
     IMN_CALLBACK_ERR,
     IMN_ENCODE_ERR,
+
+    IMN_THREAD_ERR,
+    IMN_EXT_ERR,
+    IMN_STALE_ERR,
+    IMN_RR_DESC_ERR,
     
 
 } imn_error_t;
 
 
+/**** Batch I/O Structs ****/
+
+typedef struct {
+
+    off_t offset;
+    size_t length;
+    void *buffer;
+
+    imn_error_t status;
+
+} imn_read_req_t;
+
+
+/**** Block Cache Structs ****/
+
+typedef struct {
+
+    // Byte offset and length, since block sizes differ between descriptors
+    uint64_t image_key;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t hash_next;
+
+    bool is_valid;
+    bool is_referenced;
+
+} imn_cache_entry_t;
+
+typedef struct {
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
+} imn_cache_stats_t;
+
+// CLOCK-evicted, fixed-size slots; safe to share between threads
+typedef struct imn_cache_s {
+
+    pthread_mutex_t lock;
+
+    imn_cache_entry_t *entries;
+    uint8_t *data;
+    uint32_t slot_num;
+    uint32_t clock_hand;
+
+    uint32_t *buckets;
+    uint32_t bucket_num;
+
+    imn_cache_stats_t stats;
+
+} imn_cache_t;
+
+
+/**** Instrumentation Structs ****/
+
+// Relaxed atomics; may be shared by several handles and threads
+typedef struct imn_stats_s {
+
+    atomic_uint_fast64_t bytes_read;
+    atomic_uint_fast64_t read_calls;
+    atomic_uint_fast64_t allocs;
+
+    // Joliet names that needed the full UCS-2 decoder
+    atomic_uint_fast64_t decodes;
+    atomic_uint_fast64_t records;
+
+    atomic_uint_fast64_t cache_hits;
+    atomic_uint_fast64_t cache_misses;
+
+    atomic_uint_fast64_t io_ns;
+    atomic_uint_fast64_t decode_ns;
+
+} imn_stats_t;
+
+// Any hook may be NULL; parallel traversal calls them from worker threads
+typedef struct imn_trace_s {
+
+    void (*scan_begin)(imn_record_t *dir_record, void *args);
+    void (*scan_end)(imn_record_t *dir_record, imn_error_t status,
+                        void *args);
+
+    void (*read_begin)(off_t offset, size_t length, void *args);
+    void (*read_end)(off_t offset, size_t length, imn_error_t status,
+                        void *args);
+
+    void *args;
+
+} imn_trace_t;
+
+
+/**** Read Pipeline Structs ****/
+
+// Rewrites one chunk in place; offset is the chunk's place in the file
+typedef struct {
+
+    int (*fn)(uint8_t *chunk, size_t length, off_t offset, void *args);
+    void *args;
+
+} imn_transform_t;
+
+// Stages run in order on chunk_size pieces aligned to the file start
+typedef struct imn_pipeline_s {
+
+    imn_transform_t stage_list[PIPE_STAGE_MAX];
+    uint32_t stage_num;
+
+    size_t chunk_size;
+    bool is_threaded;
+
+} imn_pipeline_t;
+
+// Last transformed chunk, for reads that start or end inside one
+typedef struct imn_chunk_cache_s {
+
+    pthread_mutex_t lock;
+
+    uint8_t *data;
+    off_t offset;
+    size_t length;
+    bool is_valid;
+
+} imn_chunk_cache_t;
+
+// Ring of chunk buffers between the reader and the stage thread
+typedef struct {
+
+    imn_file_t *file;
+    imn_pipeline_t *pipeline;
+    imn_transform_t *output;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    uint8_t *buffers[PIPE_DEPTH];
+    size_t lengths[PIPE_DEPTH];
+    off_t offsets[PIPE_DEPTH];
+
+    // Chunks read and chunks transformed; head - tail are in flight
+    uint64_t head;
+    uint64_t tail;
+    bool is_eof;
+
+    imn_error_t status;
+
+} imn_stream_t;
+
+
+/**** Parallel Traversal Structs ****/
+
+typedef struct dir_task_s {
+
+    imn_record_t record;
+    struct dir_task_s *parent;
+    atomic_uint ref_count;
+
+    imn_arena_t arena;
+    struct task_entry_s *entry_list;
+    struct task_entry_s **entry_tail;
+    bool is_done;
+
+} imn_dir_task_t;
+
+typedef struct task_entry_s {
+
+    imn_record_t record;
+    imn_dir_task_t *subdir;
+    struct task_entry_s *link;
+
+} imn_task_entry_t;
+
+typedef struct {
+
+    pthread_mutex_t lock;
+    imn_dir_task_t **task_list;
+    size_t head;
+    size_t tail;
+    size_t cap;
+
+} imn_task_deque_t;
+
+typedef struct {
+
+    imn_iso_t *iso;
+    imn_callback_t *callback;
+    bool ordered;
+
+    int worker_num;
+    imn_task_deque_t *deque_list;
+
+    atomic_size_t pending;
+    atomic_size_t queued;
+    atomic_bool abort;
+
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    pthread_cond_t done_cond;
+
+    imn_error_t status;
+
+} imn_pool_t;
+
+typedef struct {
+
+    imn_pool_t *pool;
+    int worker_id;
+
+    imn_iso_t *iso;
+    imn_block_buf_t block_buf;
+    imn_arena_t arena;
+
+} imn_worker_t;
+
+
+/**** Content Hashing Structs ****/
+
+typedef struct {
+
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    uint32_t block_len;
+
+} imn_sha256_t;
+
+// path is NUL-terminated and only valid for the duration of the call
+typedef struct {
+
+    char *path;
+    size_t path_len;
+    off_t size;
+
+    // Digests not requested in hash_flags are left zeroed
+    uint32_t crc32;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+
+} imn_hash_result_t;
+
+typedef struct {
+
+    int (*fn)(imn_hash_result_t *, void *);
+    void *args;
+
+} imn_hash_callback_t;
+
+typedef struct {
+
+    size_t path_offset;
+    size_t path_len;
+    off_t size;
+
+    // Bytes fed to the digests so far; guarded by the job lock
+    off_t hashed;
+
+    uint32_t crc32;
+    imn_sha256_t sha256;
+
+} imn_hash_file_t;
+
+// Piece of one file extent, never longer than HASH_RUN_SIZE
+typedef struct {
+
+    off_t disk_offset;
+    off_t rel_offset;
+    size_t length;
+    uint32_t file_idx;
+
+} imn_hash_seg_t;
+
+// Neighbouring segments on disk, fetched with a single read
+typedef struct {
+
+    off_t disk_offset;
+    size_t length;
+    size_t first_seg;
+    size_t seg_num;
+
+} imn_hash_run_t;
+
+// zisofs file found while collecting; hashed inflated, outside the runs
+typedef struct {
+
+    uint32_t file_idx;
+    imn_record_t record;
+
+} imn_hash_ziso_t;
+
+typedef struct {
+
+    imn_iso_t *iso;
+    imn_hash_callback_t *callback;
+    uint32_t hash_flags;
+
+    imn_hash_file_t *file_list;
+    size_t file_num;
+    size_t file_cap;
+
+    char *path_pool;
+    size_t pool_len;
+    size_t pool_cap;
+
+    imn_hash_seg_t *seg_list;
+    size_t seg_num;
+    size_t seg_cap;
+
+    imn_hash_run_t *run_list;
+    size_t run_num;
+    size_t run_cap;
+
+    imn_hash_ziso_t *ziso_list;
+    size_t ziso_num;
+    size_t ziso_cap;
+
+    // Files whose extents go backwards on disk are hashed while collecting
+    uint8_t *scratch;
+
+    atomic_size_t next_run;
+    atomic_size_t next_ziso;
+    atomic_bool abort;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_mutex_t emit_lock;
+
+    imn_error_t status;
+
+} imn_hash_job_t;
+
+
 /**** API Functions ****/
 
 imn_error_t imn_init(imn_iso_t *iso, char *iso_path, bool is_header);
 
+imn_error_t imn_init_mmap(imn_iso_t *iso, char *iso_path, bool is_header);
+
+// Switch to another PVD/SVD from iso->desc_list; records from the old one die
+imn_error_t imn_use_desc(imn_iso_t *iso, uint32_t desc_idx);
+
+void imn_close(imn_iso_t *iso);
+
+// Records handed to the callback are only valid until it returns
 imn_error_t imn_traverse_dir(imn_iso_t *iso, imn_record_t *dir_record,
         imn_callback_t *callback, bool recursive);
 
+// Like imn_traverse_dir, but keeps a running path for each callback
+imn_error_t imn_traverse_paths(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_path_callback_t *callback, bool recursive);
+
+// Flushes when full and whenever the walk changes directory
+imn_error_t imn_traverse_batch(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_entry_batch_t *batch, imn_batch_callback_t *callback,
+        bool recursive);
+
+imn_error_t imn_init_batch(imn_entry_batch_t *batch, uint32_t entry_cap,
+        size_t pool_size);
+
+void imn_free_batch(imn_entry_batch_t *batch);
+
+// dir_record must outlive the cursor; entries are valid until the next call
+imn_error_t imn_dir_open(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_dir_t *dir);
+
+// Sets *record to NULL once the directory is exhausted
+imn_error_t imn_dir_next(imn_dir_t *dir, imn_record_t **record);
+
+void imn_dir_close(imn_dir_t *dir);
+
 imn_error_t imn_get_extents(imn_record_t *dir_record,
         imn_user_extent_t *list, int list_size);
 
 imn_error_t imn_get_path(imn_record_t *record, char *buffer, int buffer_size);
 
+// Decodes the System Use area on demand, following CE continuations.
+// IMN_RR_DESC_ERR means only the PVD has Rock Ridge; see imn_use_desc
+imn_error_t imn_get_rr(imn_iso_t *iso, imn_record_t *record,
+        imn_rr_attr_t *attr);
+
+void imn_free_rr(imn_rr_attr_t *attr);
+
+// Returned record has no parent chain; release with imn_free_record
+imn_error_t imn_lookup(imn_iso_t *iso, char *path, imn_record_t *record);
+
 void imn_free_record(imn_record_t *rec);
 
+imn_error_t imn_build_index(imn_iso_t *iso, imn_index_t *index);
+
+imn_error_t imn_index_lookup(imn_index_t *index, char *path, uint32_t *entry);
+
+// Records handed to the callback are only valid until it returns
+imn_error_t imn_index_traverse(imn_index_t *index, uint32_t dir_entry,
+        imn_callback_t *callback, bool recursive);
+
+imn_error_t imn_index_extents(imn_index_t *index, uint32_t entry,
+        imn_user_extent_t *list, int list_size);
+
+void imn_free_index(imn_index_t *index);
+
+imn_error_t imn_save_index(imn_iso_t *iso, imn_index_t *index,
+        char *index_path);
+
+// Read-only after loading; IMN_STALE_ERR if the image no longer matches
+imn_error_t imn_load_index(imn_iso_t *iso, imn_index_t *index,
+        char *index_path);
+
+// Loads the sidecar, or builds the index and writes it if that fails
+imn_error_t imn_open_index(imn_iso_t *iso, imn_index_t *index,
+        char *index_path);
+
+imn_error_t imn_open(imn_iso_t *iso, imn_record_t *record, imn_file_t *file);
+
+// Positional; safe to call on one handle from several threads
+imn_error_t imn_pread(imn_file_t *file, void *buffer, size_t length,
+        off_t offset, size_t *read_len);
+
+imn_error_t imn_read(imn_file_t *file, void *buffer, size_t length,
+        size_t *read_len);
+
+void imn_close_file(imn_file_t *file);
+
+// chunk_size of 0 picks PIPE_CHUNK_SIZE
+void imn_init_pipeline(imn_pipeline_t *pipeline, size_t chunk_size,
+        bool is_threaded);
+
+imn_error_t imn_add_stage(imn_pipeline_t *pipeline, imn_transform_t *stage);
+
+// Reads may start and end anywhere; a partly read chunk is still
+// transformed whole, and kept for the next read
+imn_error_t imn_set_pipeline(imn_file_t *file, imn_pipeline_t *pipeline);
+
+// Pushes the file from its position to EOF through the pipeline, handing
+// each transformed chunk to output (if not NULL) in file order
+imn_error_t imn_stream(imn_file_t *file, imn_transform_t *output);
+
+// Callbacks run concurrently unless ordered; threads <= 0 uses every core
+imn_error_t imn_traverse_parallel(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_callback_t *callback, int thread_num, bool ordered);
+
+// Hashes every file below dir_record, reading in LBA order; zisofs files
+// are hashed inflated, as imn_read returns them. Callbacks never overlap
+// but arrive as files finish
+imn_error_t imn_hash_all(imn_iso_t *iso, imn_record_t *dir_record,
+        uint32_t hash_flags, imn_hash_callback_t *callback, int thread_num);
+
+// Caps cache memory at mem_cap bytes, rounded down to whole slots
+imn_error_t imn_cache_init(imn_cache_t *cache, size_t mem_cap);
+
+void imn_cache_free(imn_cache_t *cache);
+
+// Attach (or with NULL, detach) a cache; it must outlive the handle
+void imn_set_cache(imn_iso_t *iso, imn_cache_t *cache);
+
+void imn_cache_stats(imn_cache_t *cache, imn_cache_stats_t *stats);
+
+void imn_init_stats(imn_stats_t *stats);
+
+// Attach (or with NULL, detach) counters; they must outlive the handle
+void imn_set_stats(imn_iso_t *iso, imn_stats_t *stats);
+
+void imn_set_trace(imn_iso_t *iso, imn_trace_t *trace);
+
+// Requests may complete out of order; each one reports its own status
+imn_error_t imn_read_batch(imn_iso_t *iso, imn_read_req_t *req_list,
+        size_t req_num);
+
+// Writes at out_fd's current position; data stays in the kernel if possible.
+// zisofs files are written inflated, as imn_read would return them
+imn_error_t imn_extract_to_fd(imn_iso_t *iso, imn_record_t *record,
+        int out_fd);
+
+// Same, but zisofs files are written as stored on disk (still compressed)
+imn_error_t imn_extract_raw_to_fd(imn_iso_t *iso, imn_record_t *record,
+        int out_fd);
+
 #endif
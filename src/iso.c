@@ -1,6 +1,10 @@
 #define _XOPEN_SOURCE 700
 #define _FILE_OFFSET_BITS 64
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -9,10 +13,34 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <iconv.h>
+#include <zlib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#ifdef IMN_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 
 #include "iso.h"
 
+// Relaxed: counters are only ever summed, never used for ordering
+#define STAT_ADD(stats, field, num) \
+    do { \
+        if ((stats) != NULL) { \
+            atomic_fetch_add_explicit(&(stats)->field, (num), \
+                                        memory_order_relaxed); \
+        } \
+    } while (0)
+
 static
 uint16_t LE_int16(uint8_t *iso_num) {
     return ((uint16_t) (iso_num[0] & 0xff) 
@@ -31,24 +59,13 @@ uint64_t LE_int64(uint8_t *iso_num) {
          | ((uint64_t) (LE_int32(iso_num + 4))) << 32);
 }
 
-static
-void free_path_list(imn_cpath_t *path_header) {
-    imn_cpath_t *tmp_segment;
-    
-    while (path_header != NULL) {
-        tmp_segment = path_header->link;
-        free(tmp_segment);
-        path_header = tmp_segment;
-    }
-}
-
 static
 void free_extents(imn_extent_t *cur_extent) {
     imn_extent_t *tmp_extent;
 
     while (cur_extent != NULL) {
         tmp_extent = cur_extent->link;
-        free(tmp_extent);
+        free(cur_extent);
         cur_extent = tmp_extent;
     }
 }
@@ -58,661 +75,7513 @@ void free_rec_wrapper(imn_rawrec_wrapper_t *rec_wrapper) {
     
     if(rec_wrapper != NULL) {
 
-        if (rec_wrapper->record_id != NULL) {
-            free(rec_wrapper->record_id);
-        }
-        
-        if(rec_wrapper->raw_rec != NULL) {
-            free(rec_wrapper->raw_rec);
-        }
+        // Record points into a block buffer, identifier into the arena
+        rec_wrapper->record_id = NULL;
+        rec_wrapper->raw_rec = NULL;
     }
 }
 
-void imn_free_record(imn_record_t *rec) {
-    
-    free_extents(rec->extent_list);
+static
+void init_arena(imn_arena_t *arena, imn_stats_t *stats) {
+    arena->chunk = NULL;
+    arena->spare = NULL;
+    arena->stats = stats;
+}
 
-    if (rec != NULL && rec->record_id != NULL) {
-        free(rec->record_id);
+static
+void free_chunks(imn_arena_chunk_t *cur_chunk) {
+    imn_arena_chunk_t *tmp_chunk;
+
+    while (cur_chunk != NULL) {
+        tmp_chunk = cur_chunk->link;
+        free(cur_chunk);
+        cur_chunk = tmp_chunk;
     }
 }
 
 static
-imn_error_t handle_iconv(char *from_code, char *to_code,
-                            char *from_buff, size_t from_space,
-                            char *to_buff, size_t to_space) {
-
-    imn_error_t ret_val;
-    iconv_t id_transform;
-    size_t iconv_ret, real_space;
+void free_arena(imn_arena_t *arena) {
 
-    id_transform = iconv_open(to_code, from_code);
-    if (iconv_ret == -1) {
-        ret_val = IMN_ENCODE_ERR;
-        goto exit_normal;
+    if (arena != NULL) {
+        free_chunks(arena->chunk);
+        free_chunks(arena->spare);
+        init_arena(arena, arena->stats);
     }
+}
 
-    iconv_ret = iconv(id_transform, &from_buff, &from_space,
-                        &to_buff, &to_space);
-    if (iconv_ret < 0) {
-        ret_val = IMN_ENCODE_ERR;
-        goto exit_normal;
-    }
+static
+void *arena_alloc(imn_arena_t *arena, size_t size) {
 
-    if (iconv_close(id_transform) == -1) {
-        ret_val = IMN_ENCODE_ERR;
-        goto exit_normal;
+    imn_arena_chunk_t *chunk;
+    size_t chunk_size, align;
+    uint8_t *data;
+
+    align = _Alignof(max_align_t);
+    size = (size + align - 1) & ~(align - 1);
+
+    chunk = arena->chunk;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+
+        // Reuse a chunk released by a rewind before asking malloc
+        chunk = arena->spare;
+        if (chunk != NULL && chunk->size >= size) {
+            arena->spare = chunk->link;
+
+        } else {
+
+            chunk_size = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+            chunk = malloc(sizeof(*chunk) + chunk_size);
+            if (chunk == NULL) {
+                return NULL;
+            }
+            chunk->size = chunk_size;
+            STAT_ADD(arena->stats, allocs, 1);
+        }
+
+        chunk->used = 0;
+        chunk->link = arena->chunk;
+        arena->chunk = chunk;
     }
 
-    ret_val = IMN_OK;
-    exit_normal:
-        return ret_val;
+    data = (uint8_t *) (chunk + 1) + chunk->used;
+    chunk->used += size;
+
+    return data;
 }
 
 static
-imn_error_t get_record_id(imn_iso_t *iso, imn_rawrec_wrapper_t *rec_wrapper) {
+imn_arena_mark_t arena_mark(imn_arena_t *arena) {
 
-    imn_error_t ret_val;
-    char *raw_id, *record_id;
-    off_t id_offset;
+    imn_arena_mark_t mark;
 
-    size_t read_ret, raw_len, id_length;
-    int seek_ret, tmp_ret;
+    mark.chunk = arena->chunk;
+    mark.used = (arena->chunk != NULL) ? arena->chunk->used : 0;
 
-    if (iso == NULL || rec_wrapper == NULL) {
-        ret_val = IMN_CODE_ERR;
-        goto exit_early;
-    }
+    return mark;
+}
 
-    rec_wrapper->id_length = 0;
-    rec_wrapper->record_id = NULL;
+static
+void arena_rewind(imn_arena_t *arena, imn_arena_mark_t mark) {
 
-    id_offset = rec_wrapper->rec_offset + sizeof(imn_raw_record_t);
-    raw_len = rec_wrapper->raw_rec->len_fi[0];
+    imn_arena_chunk_t *tmp_chunk;
 
-    seek_ret = fseeko(iso->iso_file, id_offset, SEEK_SET); 
-    if (seek_ret != 0) {
-        ret_val = IMN_ACCESS_ERR;
-        goto exit_early;
+    // Chunks filled after the mark are kept around for later scopes
+    while (arena->chunk != mark.chunk) {
+        tmp_chunk = arena->chunk;
+        arena->chunk = tmp_chunk->link;
+
+        tmp_chunk->link = arena->spare;
+        arena->spare = tmp_chunk;
     }
 
-    raw_id = malloc(raw_len + 2);
-    if (raw_id == NULL) {
-        ret_val = IMN_ALLOC_ERR;
-        goto exit_early;
+    if (arena->chunk != NULL) {
+        arena->chunk->used = mark.used;
     }
-    memset(raw_id + raw_len, 0, 2);
+}
 
-    read_ret = fread(raw_id, 1, raw_len, iso->iso_file);
-    if (read_ret != raw_len) {
-        ret_val = IMN_ACCESS_ERR;
+static
+void *alloc_from(imn_arena_t *arena, size_t size) {
+    return (arena != NULL) ? arena_alloc(arena, size) : malloc(size);
+}
+
+static
+imn_error_t reserve_items(void **array, size_t *cap, size_t need,
+        size_t item_size) {
+
+    imn_error_t ret_val;
+    void *new_array;
+    size_t new_cap;
+
+    if (need <= *cap) {
+        ret_val = IMN_OK;
         goto exit_normal;
     }
 
-    id_length = (raw_len * 3) / 2;
-    record_id = malloc(id_length + 1);
-    if (record_id == NULL) {
+    new_cap = (*cap != 0) ? *cap : 64;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+
+    new_array = realloc(*array, new_cap * item_size);
+    if (new_array == NULL) {
         ret_val = IMN_ALLOC_ERR;
         goto exit_normal;
     }
 
-    if (raw_len == 1) {
-        id_length = raw_len;
-        memcpy(record_id, raw_id, raw_len + 1);
+    *array = new_array;
+    *cap = new_cap;
 
-    } else {
-        
-        if (raw_len % 2 == 1) {
-            ret_val = IMN_STD_ERR;
-            goto exit_id;
-        }
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
 
-        char *tmp = record_id;
-        ret_val = handle_iconv("UCS-2BE", "UTF-8",
-                                raw_id, raw_len + 2,
-                                record_id, id_length + 1);
-        if (ret_val < 0) {
-            goto exit_id;
-        }
+void imn_free_record(imn_record_t *rec) {
 
-        id_length = strlen(record_id);
+    if (rec == NULL) {
+        return;
     }
+    
+    free_extents(rec->extent_list);
+    rec->extent_list = NULL;
 
-    rec_wrapper->id_length = id_length;
-    rec_wrapper->record_id = record_id;
+    if (rec->record_id != NULL) {
+        free(rec->record_id);
+        rec->record_id = NULL;
+    }
+}
 
-    ret_val = IMN_OK;
-    goto exit_normal;
+static
+imn_error_t map_range(imn_iso_t *iso, off_t offset, size_t length,
+        uint8_t **data) {
+
+    imn_error_t ret_val;
+
+    if (iso == NULL || iso->iso_map == NULL || data == NULL || offset < 0) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+
+    // Range lies (partially) beyond the end of the image
+    if ((size_t) offset > iso->map_size ||
+            iso->map_size - offset < length) {
+        ret_val = IMN_ACCESS_ERR;
+        goto exit_normal;
+    }
+
+    *data = iso->iso_map + offset;
 
-    exit_id:
-        free(record_id);
+    ret_val = IMN_OK;
     exit_normal:
-        free(raw_id);
-    exit_early:
         return ret_val;
 }
 
 static
-imn_error_t search_raw_record(imn_rawrec_wrapper_t *rec_wrapper,
-        imn_iso_t *iso, imn_range_t *range, bool retrieve_id) {
+uint64_t clock_ns(void) {
 
-    imn_error_t ret_val;
-    imn_raw_record_t *raw_rec;
+    struct timespec now;
 
-    off_t rec_start, rec_end;
-    uint32_t lba_start, lba_end;
-    uint16_t block_size;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
-    size_t read_ret;
-    int seek_ret;
+static
+uint64_t read_begin(imn_iso_t *iso, off_t offset, size_t length) {
 
-    if (rec_wrapper == NULL || iso == NULL || range == NULL) {
-        ret_val = IMN_CODE_ERR;
-        goto exit_normal;
+    if (iso->trace != NULL && iso->trace->read_begin != NULL) {
+        iso->trace->read_begin(offset, length, iso->trace->args);
     }
 
-    rec_wrapper->raw_rec = NULL;
-    rec_wrapper->rec_offset = 0;
+    return (iso->stats != NULL) ? clock_ns() : 0;
+}
 
-    raw_rec = malloc(sizeof(*raw_rec));
-    if (raw_rec == NULL) {
-        ret_val = IMN_ALLOC_ERR;
+static
+void read_end(imn_iso_t *iso, off_t offset, size_t length, size_t done,
+        uint64_t start, imn_error_t status) {
+
+    if (iso->stats != NULL) {
+        STAT_ADD(iso->stats, bytes_read, done);
+        STAT_ADD(iso->stats, io_ns, clock_ns() - start);
     }
 
-    rec_start = range->start;
-    block_size = iso->desc->block_size;
+    if (iso->trace != NULL && iso->trace->read_end != NULL) {
+        iso->trace->read_end(offset, length, status, iso->trace->args);
+    }
+}
 
-    while (rec_start < range->end) {
+static
+void scan_begin(imn_iso_t *iso, imn_record_t *dir_record) {
 
-        lba_start = rec_start / block_size;
+    if (iso->trace != NULL && iso->trace->scan_begin != NULL) {
+        iso->trace->scan_begin(dir_record, iso->trace->args);
+    }
+}
 
-        if (range->end - rec_start < sizeof(imn_raw_record_t)) {
-            break;
-        }
+static
+void scan_end(imn_iso_t *iso, imn_record_t *dir_record, imn_error_t status) {
 
-        seek_ret = fseeko(iso->iso_file, rec_start, SEEK_SET);
-        if (seek_ret != 0) {
-            ret_val = IMN_ACCESS_ERR;
-            goto exit_normal;
-        }
+    if (iso->trace != NULL && iso->trace->scan_end != NULL) {
+        iso->trace->scan_end(dir_record, status, iso->trace->args);
+    }
+}
 
-        read_ret = fread(raw_rec, sizeof(*raw_rec), 1, iso->iso_file);
-        if (read_ret != 1) {
-            ret_val = IMN_ACCESS_ERR;
-            goto exit_normal;
-        }
-        
-        if (raw_rec->len_dr[0] == 0) {
-            rec_start = (lba_start + 1) * block_size;
-            continue;
-        }
+static
+imn_error_t read_span(imn_iso_t *iso, off_t offset, size_t length,
+        uint8_t *dst) {
 
-        rec_end = rec_start + raw_rec->len_dr[0];
-        lba_end = (rec_end) / block_size;
+    imn_error_t ret_val;
+    uint8_t *src;
+    ssize_t read_ret;
+    int iso_fd;
 
-        // Non-aligned record or non-zero padding; violates ISO standard
-        if (lba_start != lba_end) {
-            ret_val = IMN_STD_ERR;
+    if (iso == NULL || dst == NULL || offset < 0) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+
+    if (iso->iso_map != NULL) {
+
+        ret_val = map_range(iso, offset, length, &src);
+        if (ret_val != IMN_OK) {
             goto exit_normal;
         }
+        memcpy(dst, src, length);
 
-        // Valid record; does not fit in provided range
-        rec_end = rec_start + raw_rec->len_dr[0];
-        if (rec_end > range->end) {
-            break;
-        }
+    } else {
 
-        rec_wrapper->raw_rec = raw_rec;
-        rec_wrapper->rec_offset = rec_start;
+        // Positional reads; the handle carries no file position to share
+        iso_fd = iso->iso_fd;
+        while (length > 0) {
 
-        if (retrieve_id) {
-            ret_val = get_record_id(iso, rec_wrapper);
-            if (ret_val != IMN_OK) {
+            read_ret = pread(iso_fd, dst, length, offset);
+            STAT_ADD(iso->stats, read_calls, 1);
+
+            if (read_ret == -1 && errno == EINTR) {
+                continue;
+            }
+
+            if (read_ret <= 0) {
+                ret_val = IMN_ACCESS_ERR;
                 goto exit_normal;
             }
+
+            dst += read_ret;
+            offset += read_ret;
+            length -= read_ret;
         }
-        break;
     }
 
     ret_val = IMN_OK;
     exit_normal:
         return ret_val;
-    
 }
 
+// Every read the library issues is timed and traced here or in batch_read
 static
-imn_error_t handle_lead_extent(imn_record_t *record,
-        imn_rawrec_wrapper_t *rec_wrapper, imn_record_t *parent) {
+imn_error_t read_bytes(imn_iso_t *iso, off_t offset, size_t length,
+        uint8_t *dst) {
 
     imn_error_t ret_val;
-    imn_extent_t *lead_extent;
-    imn_raw_record_t *raw_rec;
+    uint64_t start;
 
-    size_t id_length;
-    char *record_id;
+    if (iso == NULL) {
+        return IMN_CODE_ERR;
+    }
 
-    if (record == NULL || rec_wrapper == NULL) {
-        ret_val = IMN_CODE_ERR;
-        goto exit_normal;
+    start = read_begin(iso, offset, length);
+    ret_val = read_span(iso, offset, length, dst);
+    read_end(iso, offset, length, (ret_val == IMN_OK) ? length : 0, start,
+                ret_val);
+
+    return ret_val;
+}
+
+#ifdef IMN_IO_URING
+static
+void uring_free(imn_uring_t *ring) {
+
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
     }
-    raw_rec = rec_wrapper->raw_rec;
 
-    record->is_hidden = (raw_rec->flags[0] & 0x1);
-    record->is_dir = (raw_rec->flags[0] & 0x2);
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
 
-    lead_extent = malloc(sizeof(*lead_extent));
-    if (lead_extent == NULL) {
-        ret_val = IMN_ALLOC_ERR;
+    if (ring->sq_ptr != NULL) {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+
+    // Closing does not wait for reads in flight; callers reap them first
+    close(ring->ring_fd);
+}
+
+static
+imn_error_t uring_init(imn_uring_t *ring, unsigned depth) {
+
+    imn_error_t ret_val;
+    struct io_uring_params params;
+    uint8_t *sq_ptr, *cq_ptr;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->ring_fd = syscall(__NR_io_uring_setup, depth, &params);
+    if (ring->ring_fd == -1) {
+        ret_val = IMN_ACCESS_ERR;
         goto exit_normal;
     }
 
-    lead_extent->lba_offset = LE_int32(&raw_rec->block[0]);
-    lead_extent->data_length = LE_int32(&raw_rec->length[0]);
-    lead_extent->link = NULL;
+    ring->sq_entries = params.sq_entries;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes +
+                        params.cq_entries * sizeof(struct io_uring_cqe);
 
-    record->extent_num = 1;
-    record->extent_list = lead_extent;
+    // Newer kernels share one mapping between both rings
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
 
-    record->extent_span.start = rec_wrapper->rec_offset;
-    record->extent_span.end = rec_wrapper->rec_offset +
-                                rec_wrapper->raw_rec->len_dr[0];
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        ret_val = IMN_ACCESS_ERR;
+        goto exit_ring;
+    }
 
-    record->total_size = lead_extent->data_length;
-    record->parent_dir = parent;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
 
-    id_length = rec_wrapper->id_length;
-    if (!record->is_dir) {
-        id_length -= 2;
+    } else {
+
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            ret_val = IMN_ACCESS_ERR;
+            goto exit_ring;
+        }
     }
 
-    record_id = malloc(id_length + 1);
-    if (record_id == NULL) {
-        ret_val = IMN_ALLOC_ERR;
-        goto exit_normal;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                        IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        ret_val = IMN_ACCESS_ERR;
+        goto exit_ring;
     }
-    memcpy(record_id, rec_wrapper->record_id, id_length);
-    record_id[id_length] = '\0';
 
-    record->id_length = id_length;
-    record->record_id = record_id;
+    sq_ptr = ring->sq_ptr;
+    cq_ptr = ring->cq_ptr;
+
+    ring->sq_head = (unsigned *) (sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq_ptr + params.sq_off.array);
+
+    ring->cq_head = (unsigned *) (cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq_ptr + params.cq_off.cqes);
 
     ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_ring:
+        uring_free(ring);
     exit_normal:
         return ret_val;
 }
 
+// Call with ring_lock held
 static
-imn_error_t search_record(imn_record_t *record, imn_iso_t *iso,
-        imn_record_t *parent, imn_range_t *global_range) {
-
-    imn_error_t ret_val;
+imn_uring_t *uring_get(imn_iso_t *iso) {
 
-    imn_rawrec_wrapper_t rec_wrapper;
-    imn_raw_record_t *raw_rec;
-    imn_extent_t *cur_extent;
-    imn_range_t local_range;
+    if (iso->ring == NULL && !iso->ring_failed) {
 
-    bool multi_extent;
-    off_t cur_loc;
+        iso->ring = malloc(sizeof(*iso->ring));
+        if (iso->ring != NULL && uring_init(iso->ring, URING_DEPTH) != IMN_OK) {
+            free(iso->ring);
+            iso->ring = NULL;
+        }
 
-    if (record == NULL || iso == NULL || global_range == NULL) {
-        ret_val = IMN_CODE_ERR;
-        goto exit_normal;
+        // Old kernel or seccomp; don't retry the setup on every batch
+        iso->ring_failed = (iso->ring == NULL);
     }
 
-    record->extent_list = NULL;
-    record->extent_num = 0;
+    return iso->ring;
+}
 
-    local_range.start = global_range->start;
-    local_range.end = global_range->end;
+static
+void uring_drop(imn_iso_t *iso) {
 
-    ret_val = search_raw_record(&rec_wrapper, iso, &local_range, true);
-    if (ret_val != IMN_OK) {
-        goto exit_normal;
+    if (iso->ring != NULL) {
+        uring_free(iso->ring);
+        free(iso->ring);
+        iso->ring = NULL;
     }
+}
 
-    raw_rec = rec_wrapper.raw_rec;
-    if (raw_rec == NULL) {
-        ret_val = IMN_OK;
-        goto exit_normal;
-    }
+static
+void uring_complete(imn_iso_t *iso, imn_read_req_t *req, int res) {
 
-    ret_val = handle_lead_extent(record, &rec_wrapper, parent);
-    if (ret_val != IMN_OK) {
-        goto exit_wrapper;
-    }
+    // Short or refused reads are finished synchronously
+    if (res >= 0 && (size_t) res == req->length) {
+        req->status = IMN_OK;
+
+    } else if (res > 0) {
+        req->status = read_span(iso, req->offset + res, req->length - res,
+                                    (uint8_t *) req->buffer + res);
+
+    } else if (res == -EINVAL || res == -EOPNOTSUPP ||
+                res == -EAGAIN || res == -EINTR) {
+        req->status = read_span(iso, req->offset, req->length,
+                                    req->buffer);
+
+    } else {
+        req->status = IMN_ACCESS_ERR;
+    }
+}
+
+static
+unsigned uring_reap(imn_iso_t *iso, imn_uring_t *ring,
+        imn_read_req_t *req_list) {
+
+    struct io_uring_cqe *cqe;
+    unsigned head, reaped;
+
+    reaped = 0;
+    head = *ring->cq_head;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+
+        cqe = &ring->cqes[head & *ring->cq_mask];
+        uring_complete(iso, &req_list[cqe->user_data], cqe->res);
+
+        head++;
+        reaped++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    return reaped;
+}
+
+static
+bool uring_batch(imn_iso_t *iso, imn_read_req_t *req_list, size_t req_num) {
+
+    imn_uring_t *ring;
+    struct io_uring_sqe *sqe;
+
+    size_t submitted, completed, req_idx;
+    unsigned tail, inflight, to_submit, sqe_idx, reaped;
+    int iso_fd, enter_ret;
+    bool is_broken;
+
+    // Rings are single-issuer; a concurrent batch takes the pread path
+    if (pthread_mutex_trylock(&iso->ring_lock) != 0) {
+        return false;
+    }
+
+    ring = uring_get(iso);
+    if (ring == NULL) {
+        pthread_mutex_unlock(&iso->ring_lock);
+        return false;
+    }
+
+    // Anything not reaped from the ring is read synchronously afterwards
+    for (req_idx = 0; req_idx < req_num; req_idx++) {
+        req_list[req_idx].status = IMN_CODE_ERR;
+    }
+
+    iso_fd = iso->iso_fd;
+    submitted = 0;
+    completed = 0;
+    inflight = 0;
+
+    // Entries the kernel has not consumed yet stay queued in the SQ ring
+    to_submit = 0;
+    is_broken = false;
+
+    while (completed < req_num) {
+
+        tail = *ring->sq_tail;
+
+        while (submitted < req_num && inflight < ring->sq_entries) {
+
+            sqe_idx = tail & *ring->sq_mask;
+            sqe = &ring->sqes[sqe_idx];
+            memset(sqe, 0, sizeof(*sqe));
+
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = iso_fd;
+            sqe->addr = (uintptr_t) req_list[submitted].buffer;
+            sqe->len = req_list[submitted].length;
+            sqe->off = req_list[submitted].offset;
+            sqe->user_data = submitted;
+
+            ring->sq_array[sqe_idx] = sqe_idx;
+
+            tail++;
+            submitted++;
+            inflight++;
+            to_submit++;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        enter_ret = syscall(__NR_io_uring_enter, ring->ring_fd, to_submit, 1,
+                                IORING_ENTER_GETEVENTS, NULL, 0);
+        STAT_ADD(iso->stats, read_calls, 1);
+
+        if (enter_ret >= 0) {
+            to_submit -= enter_ret;
+
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            is_broken = true;
+            break;
+        }
+
+        reaped = uring_reap(iso, ring, req_list);
+        inflight -= reaped;
+        completed += reaped;
+    }
+
+    if (is_broken) {
+
+        // A failed enter consumed nothing, but earlier reads may still land
+        // in the caller's buffers; wait them out before closing the ring
+        inflight -= to_submit;
+
+        while (inflight > 0) {
+
+            enter_ret = syscall(__NR_io_uring_enter, ring->ring_fd, 0,
+                                    inflight, IORING_ENTER_GETEVENTS, NULL, 0);
+            STAT_ADD(iso->stats, read_calls, 1);
+
+            if (enter_ret == -1 && errno != EINTR && errno != EAGAIN &&
+                    errno != EBUSY) {
+                break;
+            }
+            inflight -= uring_reap(iso, ring, req_list);
+        }
+
+        // Stale entries would leak into the next batch; start over
+        uring_drop(iso);
+        iso->ring_failed = true;
+    }
+
+    pthread_mutex_unlock(&iso->ring_lock);
+
+    for (req_idx = 0; req_idx < req_num; req_idx++) {
+        if (req_list[req_idx].status == IMN_CODE_ERR) {
+            req_list[req_idx].status = read_span(iso,
+                                            req_list[req_idx].offset,
+                                            req_list[req_idx].length,
+                                            req_list[req_idx].buffer);
+        }
+    }
+
+    return true;
+}
+
+// SQE lengths and CQE results are 32-bit, so oversized requests are queued
+// as URING_READ_MAX pieces; the original list is reused when none are
+static
+imn_error_t split_requests(imn_iso_t *iso, imn_read_req_t *req_list,
+        size_t req_num, imn_read_req_t **split_list, size_t *split_num) {
+
+    imn_error_t ret_val;
+    imn_read_req_t *piece;
+    size_t req_idx, piece_num, done;
+
+    piece_num = 0;
+    for (req_idx = 0; req_idx < req_num; req_idx++) {
+        piece_num += (req_list[req_idx].length <= URING_READ_MAX) ? 1 :
+                        (req_list[req_idx].length + URING_READ_MAX - 1) /
+                        URING_READ_MAX;
+    }
+
+    if (piece_num == req_num) {
+        *split_list = req_list;
+        *split_num = req_num;
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    *split_list = malloc(piece_num * sizeof(**split_list));
+    if (*split_list == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+    STAT_ADD(iso->stats, allocs, 1);
+
+    piece = *split_list;
+    for (req_idx = 0; req_idx < req_num; req_idx++) {
+
+        done = 0;
+        do {
+            piece->offset = req_list[req_idx].offset + (off_t) done;
+            piece->buffer = (uint8_t *) req_list[req_idx].buffer + done;
+            piece->length = req_list[req_idx].length - done;
+            if (piece->length > URING_READ_MAX) {
+                piece->length = URING_READ_MAX;
+            }
+
+            done += piece->length;
+            piece++;
+        } while (done < req_list[req_idx].length);
+    }
+    *split_num = piece_num;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+// Each request takes the first failure among its pieces
+static
+void fold_requests(imn_read_req_t *req_list, size_t req_num,
+        imn_read_req_t *split_list) {
+
+    imn_read_req_t *piece;
+    size_t req_idx, done;
+
+    piece = split_list;
+    for (req_idx = 0; req_idx < req_num; req_idx++) {
+
+        req_list[req_idx].status = IMN_OK;
+
+        done = 0;
+        do {
+            if (req_list[req_idx].status == IMN_OK) {
+                req_list[req_idx].status = piece->status;
+            }
+
+            done += piece->length;
+            piece++;
+        } while (done < req_list[req_idx].length);
+    }
+}
+#endif
+
+static
+imn_error_t batch_read(imn_iso_t *iso, imn_read_req_t *req_list,
+        size_t req_num) {
+
+    imn_error_t ret_val;
+    size_t req_idx, run_end, run_len;
+    bool is_done;
+
+#ifdef IMN_IO_URING
+    imn_read_req_t *split_list;
+    uint64_t start;
+    size_t done, split_num;
+#endif
+
+    is_done = false;
+
+#ifdef IMN_IO_URING
+    // Without memory for the pieces the batch just takes the pread path
+    if (iso->iso_map == NULL && req_num > 1 &&
+            split_requests(iso, req_list, req_num, &split_list,
+                            &split_num) == IMN_OK) {
+
+        // The ring is traced as one read spanning the whole batch
+        start = read_begin(iso, req_list[0].offset,
+                            req_list[req_num - 1].offset +
+                            req_list[req_num - 1].length - req_list[0].offset);
+        is_done = uring_batch(iso, split_list, split_num);
+
+        if (split_list != req_list) {
+            fold_requests(req_list, req_num, split_list);
+            free(split_list);
+        }
+
+        done = 0;
+        ret_val = IMN_OK;
+        for (req_idx = 0; is_done && req_idx < req_num; req_idx++) {
+            if (req_list[req_idx].status == IMN_OK) {
+                done += req_list[req_idx].length;
+            } else {
+                ret_val = req_list[req_idx].status;
+            }
+        }
+
+        read_end(iso, req_list[0].offset, req_list[req_num - 1].offset +
+                    req_list[req_num - 1].length - req_list[0].offset,
+                    done, start, is_done ? ret_val : IMN_ACCESS_ERR);
+    }
+#endif
+
+    // Fallback merges requests that continue each other on both sides
+    for (req_idx = 0; !is_done && req_idx < req_num; req_idx = run_end) {
+
+        run_len = req_list[req_idx].length;
+        run_end = req_idx + 1;
+
+        while (run_end < req_num &&
+                req_list[run_end].offset == req_list[run_end - 1].offset +
+                    (off_t) req_list[run_end - 1].length &&
+                (uint8_t *) req_list[run_end].buffer ==
+                    (uint8_t *) req_list[run_end - 1].buffer +
+                    req_list[run_end - 1].length) {
+            run_len += req_list[run_end].length;
+            run_end++;
+        }
+
+        ret_val = read_bytes(iso, req_list[req_idx].offset, run_len,
+                                req_list[req_idx].buffer);
+
+        while (req_idx < run_end) {
+            req_list[req_idx++].status = ret_val;
+        }
+    }
+
+    ret_val = IMN_OK;
+    for (req_idx = 0; req_idx < req_num; req_idx++) {
+        if (req_list[req_idx].status != IMN_OK) {
+            ret_val = req_list[req_idx].status;
+            break;
+        }
+    }
+
+    return ret_val;
+}
+
+imn_error_t imn_cache_init(imn_cache_t *cache, size_t mem_cap) {
+
+    imn_error_t ret_val;
+    uint32_t slot_idx;
+    size_t slot_num;
+
+    if (cache == NULL || mem_cap < CACHE_SLOT_SIZE) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+
+    slot_num = mem_cap / CACHE_SLOT_SIZE;
+    if (slot_num >= CACHE_NIL) {
+        slot_num = CACHE_NIL - 1;
+    }
+    cache->slot_num = slot_num;
+
+    // Twice as many buckets as slots keeps chains short
+    cache->bucket_num = 1;
+    while (cache->bucket_num < cache->slot_num * 2) {
+        cache->bucket_num *= 2;
+    }
+
+    cache->entries = calloc(cache->slot_num, sizeof(*cache->entries));
+    cache->data = malloc((size_t) cache->slot_num * CACHE_SLOT_SIZE);
+    cache->buckets = malloc(cache->bucket_num * sizeof(*cache->buckets));
+
+    if (cache->entries == NULL || cache->data == NULL ||
+            cache->buckets == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_cache;
+    }
+
+    for (slot_idx = 0; slot_idx < cache->bucket_num; slot_idx++) {
+        cache->buckets[slot_idx] = CACHE_NIL;
+    }
+
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+        ret_val = IMN_THREAD_ERR;
+        goto exit_cache;
+    }
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_cache:
+        free(cache->entries);
+        free(cache->data);
+        free(cache->buckets);
+        memset(cache, 0, sizeof(*cache));
+    exit_normal:
+        return ret_val;
+}
+
+void imn_cache_free(imn_cache_t *cache) {
+
+    if (cache == NULL || cache->entries == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+
+    free(cache->entries);
+    free(cache->data);
+    free(cache->buckets);
+
+    memset(cache, 0, sizeof(*cache));
+}
+
+void imn_set_cache(imn_iso_t *iso, imn_cache_t *cache) {
+
+    if (iso != NULL) {
+        iso->cache = cache;
+    }
+}
+
+void imn_init_stats(imn_stats_t *stats) {
+
+    if (stats == NULL) {
+        return;
+    }
+
+    atomic_init(&stats->bytes_read, 0);
+    atomic_init(&stats->read_calls, 0);
+    atomic_init(&stats->allocs, 0);
+    atomic_init(&stats->decodes, 0);
+    atomic_init(&stats->records, 0);
+    atomic_init(&stats->cache_hits, 0);
+    atomic_init(&stats->cache_misses, 0);
+    atomic_init(&stats->io_ns, 0);
+    atomic_init(&stats->decode_ns, 0);
+}
+
+void imn_set_stats(imn_iso_t *iso, imn_stats_t *stats) {
+
+    if (iso != NULL) {
+        iso->stats = stats;
+    }
+}
+
+void imn_set_trace(imn_iso_t *iso, imn_trace_t *trace) {
+
+    if (iso != NULL) {
+        iso->trace = trace;
+    }
+}
+
+void imn_cache_stats(imn_cache_t *cache, imn_cache_stats_t *stats) {
+
+    if (cache == NULL || stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static
+uint32_t *cache_bucket(imn_cache_t *cache, uint64_t image_key,
+        uint64_t offset) {
+
+    uint64_t hash;
+
+    hash = (image_key ^ offset) * 0x9E3779B97F4A7C15ull;
+    return &cache->buckets[(hash >> 32) & (cache->bucket_num - 1)];
+}
+
+static
+bool cache_get(imn_cache_t *cache, uint64_t image_key, uint64_t offset,
+        uint8_t *dst, size_t length) {
+
+    imn_cache_entry_t *entry;
+    uint32_t slot_idx;
+    bool is_hit;
+
+    is_hit = false;
+    pthread_mutex_lock(&cache->lock);
+
+    slot_idx = *cache_bucket(cache, image_key, offset);
+    while (slot_idx != CACHE_NIL) {
+
+        entry = &cache->entries[slot_idx];
+        if (entry->image_key == image_key && entry->offset == offset &&
+                entry->length == length) {
+
+            // Copied out under the lock; the slot may be reused right after
+            memcpy(dst, cache->data + (size_t) slot_idx * CACHE_SLOT_SIZE,
+                    length);
+            entry->is_referenced = true;
+            is_hit = true;
+            break;
+        }
+        slot_idx = entry->hash_next;
+    }
+
+    if (is_hit) {
+        cache->stats.hits++;
+    } else {
+        cache->stats.misses++;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return is_hit;
+}
+
+static
+void cache_unlink(imn_cache_t *cache, uint32_t victim_idx) {
+
+    imn_cache_entry_t *victim;
+    uint32_t *link;
+
+    victim = &cache->entries[victim_idx];
+    link = cache_bucket(cache, victim->image_key, victim->offset);
+
+    while (*link != victim_idx) {
+        link = &cache->entries[*link].hash_next;
+    }
+    *link = victim->hash_next;
+}
+
+static
+void cache_put(imn_cache_t *cache, uint64_t image_key, uint64_t offset,
+        uint8_t *src, size_t length) {
+
+    imn_cache_entry_t *entry;
+    uint32_t *bucket;
+    uint32_t slot_idx;
+
+    pthread_mutex_lock(&cache->lock);
+
+    // Another handle may have inserted it while we were reading
+    bucket = cache_bucket(cache, image_key, offset);
+    for (slot_idx = *bucket; slot_idx != CACHE_NIL;
+            slot_idx = cache->entries[slot_idx].hash_next) {
+
+        entry = &cache->entries[slot_idx];
+        if (entry->image_key == image_key && entry->offset == offset &&
+                entry->length == length) {
+            goto exit_lock;
+        }
+    }
+
+    // CLOCK: referenced slots get a second chance before eviction
+    while (cache->entries[cache->clock_hand].is_valid &&
+            cache->entries[cache->clock_hand].is_referenced) {
+
+        cache->entries[cache->clock_hand].is_referenced = false;
+        cache->clock_hand = (cache->clock_hand + 1) % cache->slot_num;
+    }
+
+    slot_idx = cache->clock_hand;
+    cache->clock_hand = (cache->clock_hand + 1) % cache->slot_num;
+    entry = &cache->entries[slot_idx];
+
+    if (entry->is_valid) {
+        cache_unlink(cache, slot_idx);
+        cache->stats.evictions++;
+    }
+
+    memcpy(cache->data + (size_t) slot_idx * CACHE_SLOT_SIZE, src, length);
+
+    entry->image_key = image_key;
+    entry->offset = offset;
+    entry->length = length;
+    entry->is_valid = true;
+    entry->is_referenced = false;
+
+    bucket = cache_bucket(cache, image_key, offset);
+    entry->hash_next = *bucket;
+    *bucket = slot_idx;
+
+    exit_lock:
+        pthread_mutex_unlock(&cache->lock);
+}
+
+static
+imn_error_t init_block_buf(imn_iso_t *iso, imn_block_buf_t *buf) {
+
+    imn_error_t ret_val;
+    uint16_t block_size;
+
+    if (iso == NULL || buf == NULL || iso->desc->block_size == 0) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+    block_size = iso->desc->block_size;
+
+    buf->lba = 0;
+    buf->block_num = 0;
+    buf->block_cap = 0;
+    buf->window_end = 0;
+    buf->is_loaded = false;
+    buf->block_size = block_size;
+    buf->data = NULL;
+    buf->storage = NULL;
+
+    // Mapped images hand out blocks in place; no copy buffer needed
+    if (iso->iso_map != NULL) {
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    buf->storage = malloc(block_size);
+    if (buf->storage == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+    STAT_ADD(iso->stats, allocs, 1);
+    buf->data = buf->storage;
+    buf->block_cap = 1;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+void free_block_buf(imn_block_buf_t *buf) {
+
+    if (buf != NULL) {
+
+        if (buf->storage != NULL) {
+            free(buf->storage);
+            buf->storage = NULL;
+        }
+
+        buf->data = NULL;
+        buf->is_loaded = false;
+        buf->block_cap = 0;
+    }
+}
+
+static
+imn_error_t set_read_window(imn_iso_t *iso, imn_block_buf_t *buf,
+        uint32_t lba, uint32_t block_num) {
+
+    imn_error_t ret_val;
+    uint32_t window_cap;
+    uint8_t *new_storage;
+
+    // Mapped blocks are already addressable; nothing to read ahead
+    if (iso->iso_map != NULL) {
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    window_cap = DIR_WINDOW_SIZE / buf->block_size;
+    if (block_num < window_cap) {
+        window_cap = block_num;
+    }
+
+    if (window_cap > buf->block_cap) {
+
+        new_storage = realloc(buf->storage,
+                                (size_t) window_cap * buf->block_size);
+        if (new_storage == NULL) {
+            ret_val = IMN_ALLOC_ERR;
+            goto exit_normal;
+        }
+        STAT_ADD(iso->stats, allocs, 1);
+
+        buf->storage = new_storage;
+        buf->block_cap = window_cap;
+        buf->is_loaded = false;
+    }
+
+    buf->window_end = lba + block_num;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t fill_window(imn_iso_t *iso, imn_block_buf_t *buf, uint32_t lba) {
+
+    imn_error_t ret_val;
+    imn_read_req_t req_list[DIR_WINDOW_SIZE / BATCH_CHUNK_SIZE + 1];
+
+    size_t fill_len, req_num, req_pos;
+    uint32_t block_num;
+
+    block_num = 1;
+    if (buf->window_end > lba) {
+        block_num = buf->window_end - lba;
+        if (block_num > buf->block_cap) {
+            block_num = buf->block_cap;
+        }
+    }
+
+    // Whole window goes out as one batch of independent chunk reads
+    fill_len = (size_t) block_num * buf->block_size;
+    req_num = 0;
+
+    for (req_pos = 0; req_pos < fill_len; req_pos += BATCH_CHUNK_SIZE) {
+
+        req_list[req_num].offset = (off_t) lba * buf->block_size + req_pos;
+        req_list[req_num].buffer = buf->storage + req_pos;
+        req_list[req_num].length = fill_len - req_pos;
+
+        if (req_list[req_num].length > BATCH_CHUNK_SIZE) {
+            req_list[req_num].length = BATCH_CHUNK_SIZE;
+        }
+        req_num++;
+    }
+
+    ret_val = batch_read(iso, req_list, req_num);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    buf->lba = lba;
+    buf->block_num = block_num;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t load_cached(imn_iso_t *iso, imn_block_buf_t *buf, uint32_t lba) {
+
+    imn_error_t ret_val;
+    uint32_t block_idx;
+    bool use_cache;
+
+    use_cache = (iso->cache != NULL && buf->block_size <= CACHE_SLOT_SIZE);
+
+    if (use_cache && cache_get(iso->cache, iso->image_key,
+                                (uint64_t) lba * buf->block_size,
+                                buf->storage, buf->block_size)) {
+        buf->lba = lba;
+        buf->block_num = 1;
+        STAT_ADD(iso->stats, cache_hits, 1);
+
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    if (use_cache) {
+        STAT_ADD(iso->stats, cache_misses, 1);
+    }
+
+    ret_val = fill_window(iso, buf, lba);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    // Whole read-ahead window is published, not just the requested block
+    for (block_idx = 0; use_cache && block_idx < buf->block_num;
+            block_idx++) {
+        cache_put(iso->cache, iso->image_key,
+                    (uint64_t) (lba + block_idx) * buf->block_size,
+                    buf->storage + (size_t) block_idx * buf->block_size,
+                    buf->block_size);
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t load_block(imn_iso_t *iso, imn_block_buf_t *buf, uint32_t lba) {
+
+    imn_error_t ret_val;
+    off_t block_start;
+
+    if (iso == NULL || buf == NULL) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+
+    // Block already buffered; nothing to read
+    if (buf->is_loaded && lba >= buf->lba &&
+            lba - buf->lba < buf->block_num) {
+        buf->data = (iso->iso_map != NULL) ? buf->data :
+                        buf->storage + (size_t) (lba - buf->lba) *
+                                        buf->block_size;
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    buf->is_loaded = false;
+    block_start = (off_t) lba * buf->block_size;
+
+    if (iso->iso_map != NULL) {
+
+        ret_val = map_range(iso, block_start, buf->block_size, &buf->data);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+        STAT_ADD(iso->stats, bytes_read, buf->block_size);
+
+        buf->lba = lba;
+        buf->block_num = 1;
+
+    } else {
+
+        if (buf->storage == NULL) {
+            ret_val = IMN_CODE_ERR;
+            goto exit_normal;
+        }
+
+        ret_val = load_cached(iso, buf, lba);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+        buf->data = buf->storage;
+    }
+
+    buf->is_loaded = true;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+bool decode_ascii_id(char *from_buff, size_t from_space, char *to_buff) {
+
+    uint8_t *raw_id;
+    size_t raw_pos;
+
+    raw_id = (uint8_t *) from_buff;
+
+    // UCS-2BE code points below 0x80 map 1:1 onto UTF-8
+    for (raw_pos = 0; raw_pos < from_space; raw_pos += 2) {
+        if (raw_id[raw_pos] != 0 || raw_id[raw_pos + 1] >= 0x80) {
+            return false;
+        }
+        to_buff[raw_pos / 2] = raw_id[raw_pos + 1];
+    }
+
+    return true;
+}
+
+static
+imn_error_t decode_ucs2_id(char *from_buff, size_t from_space,
+                            char *to_buff, size_t *to_len) {
+
+    imn_error_t ret_val;
+    uint8_t *raw_id, *out;
+    uint32_t code, low;
+    size_t raw_pos;
+
+    raw_id = (uint8_t *) from_buff;
+    out = (uint8_t *) to_buff;
+
+    // Stateless, so one handle can decode from any number of threads;
+    // surrogate pairs are accepted since real Joliet writers emit them
+    for (raw_pos = 0; raw_pos < from_space; raw_pos += 2) {
+
+        code = ((uint32_t) raw_id[raw_pos] << 8) | raw_id[raw_pos + 1];
+
+        if (code >= 0xD800 && code <= 0xDBFF) {
+
+            if (raw_pos + 4 > from_space) {
+                ret_val = IMN_ENCODE_ERR;
+                goto exit_normal;
+            }
+
+            low = ((uint32_t) raw_id[raw_pos + 2] << 8) | raw_id[raw_pos + 3];
+            if (low < 0xDC00 || low > 0xDFFF) {
+                ret_val = IMN_ENCODE_ERR;
+                goto exit_normal;
+            }
+
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            raw_pos += 2;
+
+        } else if (code >= 0xDC00 && code <= 0xDFFF) {
+            ret_val = IMN_ENCODE_ERR;
+            goto exit_normal;
+        }
+
+        if (code < 0x80) {
+            *out++ = code;
+
+        } else if (code < 0x800) {
+            *out++ = 0xC0 | (code >> 6);
+            *out++ = 0x80 | (code & 0x3F);
+
+        } else if (code < 0x10000) {
+            *out++ = 0xE0 | (code >> 12);
+            *out++ = 0x80 | ((code >> 6) & 0x3F);
+            *out++ = 0x80 | (code & 0x3F);
+
+        } else {
+            *out++ = 0xF0 | (code >> 18);
+            *out++ = 0x80 | ((code >> 12) & 0x3F);
+            *out++ = 0x80 | ((code >> 6) & 0x3F);
+            *out++ = 0x80 | (code & 0x3F);
+        }
+    }
+
+    *to_len = out - (uint8_t *) to_buff;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t decode_id(imn_iso_t *iso, char *raw_id, size_t raw_len,
+        char *record_id, size_t *id_length) {
+
+    imn_error_t ret_val;
+    size_t out_len;
+
+    // Output must hold (raw_len * 3) / 2 + 1 bytes
+    out_len = (raw_len * 3) / 2;
+
+    // Non-Joliet descriptors store 8-bit identifiers
+    if (iso->desc->joliet_level == 0) {
+        out_len = raw_len;
+        memcpy(record_id, raw_id, raw_len);
+
+    } else if (raw_len == 1) {
+        out_len = raw_len;
+        record_id[0] = raw_id[0];
+
+    } else {
+        
+        if (raw_len % 2 == 1) {
+            ret_val = IMN_STD_ERR;
+            goto exit_normal;
+        }
+
+        if (decode_ascii_id(raw_id, raw_len, record_id)) {
+            out_len = raw_len / 2;
+
+        } else {
+
+            ret_val = decode_ucs2_id(raw_id, raw_len, record_id, &out_len);
+            STAT_ADD(iso->stats, decodes, 1);
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
+        }
+    }
+
+    record_id[out_len] = '\0';
+    *id_length = out_len;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t get_record_id(imn_iso_t *iso, imn_rawrec_wrapper_t *rec_wrapper,
+        imn_arena_t *arena) {
+
+    imn_error_t ret_val;
+    char *raw_id, *record_id;
+    size_t raw_len, id_length;
+    uint64_t start;
+
+    if (iso == NULL || rec_wrapper == NULL || arena == NULL) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+
+    rec_wrapper->id_length = 0;
+    rec_wrapper->record_id = NULL;
+
+    // Identifier directly follows the record; parse in place
+    raw_id = (char *) rec_wrapper->raw_rec + sizeof(imn_raw_record_t);
+    raw_len = rec_wrapper->raw_rec->len_fi[0];
+
+    if (sizeof(imn_raw_record_t) + raw_len > rec_wrapper->raw_rec->len_dr[0]) {
+        ret_val = IMN_STD_ERR;
+        goto exit_normal;
+    }
+
+    // d-characters are usable as-is; point straight into the block
+    if (iso->desc->joliet_level == 0) {
+        rec_wrapper->id_length = raw_len;
+        rec_wrapper->record_id = raw_id;
+
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    record_id = arena_alloc(arena, (raw_len * 3) / 2 + 1);
+    if (record_id == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    start = (iso->stats != NULL) ? clock_ns() : 0;
+
+    ret_val = decode_id(iso, raw_id, raw_len, record_id, &id_length);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    if (iso->stats != NULL) {
+        STAT_ADD(iso->stats, decode_ns, clock_ns() - start);
+    }
+
+    rec_wrapper->id_length = id_length;
+    rec_wrapper->record_id = record_id;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t search_raw_record(imn_rawrec_wrapper_t *rec_wrapper,
+        imn_iso_t *iso, imn_block_buf_t *buf, imn_arena_t *arena,
+        imn_range_t *range, bool retrieve_id) {
+
+    imn_error_t ret_val;
+    imn_raw_record_t *raw_rec;
+
+    off_t rec_start, rec_end;
+    uint32_t lba_start, block_off;
+    uint16_t block_size;
+    uint8_t rec_len;
+
+    if (rec_wrapper == NULL || iso == NULL || buf == NULL || range == NULL) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+
+    rec_wrapper->raw_rec = NULL;
+    rec_wrapper->rec_offset = 0;
+    rec_wrapper->record_id = NULL;
+    rec_wrapper->id_length = 0;
+
+    rec_start = range->start;
+    block_size = buf->block_size;
+
+    while (rec_start < range->end) {
+
+        lba_start = rec_start / block_size;
+        block_off = rec_start % block_size;
+
+        if (range->end - rec_start < sizeof(imn_raw_record_t)) {
+            break;
+        }
+
+        ret_val = load_block(iso, buf, lba_start);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        rec_len = buf->data[block_off];
+        if (rec_len == 0) {
+            rec_start = (off_t) (lba_start + 1) * block_size;
+            continue;
+        }
+
+        // Non-aligned record or non-zero padding; violates ISO standard
+        if (rec_len < sizeof(imn_raw_record_t) ||
+                block_off + rec_len > block_size) {
+            ret_val = IMN_STD_ERR;
+            goto exit_normal;
+        }
+
+        // Valid record; does not fit in provided range
+        rec_end = rec_start + rec_len;
+        if (rec_end > range->end) {
+            break;
+        }
+
+        raw_rec = (imn_raw_record_t *) (buf->data + block_off);
+
+        rec_wrapper->raw_rec = raw_rec;
+        rec_wrapper->rec_offset = rec_start;
+        STAT_ADD(iso->stats, records, 1);
+
+        if (retrieve_id) {
+            ret_val = get_record_id(iso, rec_wrapper, arena);
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
+        }
+        break;
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+    
+}
+
+static
+size_t strip_version(char *record_id, size_t id_length, bool is_joliet) {
+
+    size_t id_pos;
+
+    // Drop a trailing ";<digits>" file version, if there is one
+    for (id_pos = id_length; id_pos > 0; id_pos--) {
+        if (record_id[id_pos - 1] < '0' || record_id[id_pos - 1] > '9') {
+            break;
+        }
+    }
+
+    if (id_pos > 0 && id_pos < id_length && record_id[id_pos - 1] == ';') {
+        id_length = id_pos - 1;
+    }
+
+    // "NAME.;1" is how ISO-9660 spells a file without an extension
+    if (!is_joliet && id_length > 1 && record_id[id_length - 1] == '.') {
+        id_length--;
+    }
+
+    return id_length;
+}
+
+static
+imn_error_t handle_lead_extent(imn_record_t *record,
+        imn_rawrec_wrapper_t *rec_wrapper, imn_record_t *parent,
+        imn_arena_t *arena, bool is_joliet) {
+
+    imn_error_t ret_val;
+    imn_extent_t *lead_extent;
+    imn_raw_record_t *raw_rec;
+
+    size_t id_length;
+    char *record_id;
+
+    if (record == NULL || rec_wrapper == NULL) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+    raw_rec = rec_wrapper->raw_rec;
+
+    record->is_hidden = (raw_rec->flags[0] & 0x1);
+    record->is_dir = (raw_rec->flags[0] & 0x2);
+
+    // Without an arena the record outlives traversal (e.g. root directory)
+    lead_extent = alloc_from(arena, sizeof(*lead_extent));
+    if (lead_extent == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    lead_extent->lba_offset = LE_int32(&raw_rec->block[0]);
+    lead_extent->data_length = LE_int32(&raw_rec->length[0]);
+    lead_extent->link = NULL;
+
+    record->extent_num = 1;
+    record->extent_list = lead_extent;
+
+    record->extent_span.start = rec_wrapper->rec_offset;
+    record->extent_span.end = rec_wrapper->rec_offset +
+                                rec_wrapper->raw_rec->len_dr[0];
+
+    record->total_size = lead_extent->data_length;
+    record->parent_dir = parent;
+
+    id_length = rec_wrapper->id_length;
+    if (!record->is_dir) {
+        id_length = strip_version(rec_wrapper->record_id, id_length,
+                                    is_joliet);
+    }
+
+    record_id = alloc_from(arena, id_length + 1);
+    if (record_id == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_extent;
+    }
+    memcpy(record_id, rec_wrapper->record_id, id_length);
+    record_id[id_length] = '\0';
+
+    record->id_length = id_length;
+    record->record_id = record_id;
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_extent:
+        if (arena == NULL) {
+            free(lead_extent);
+        }
+        record->extent_list = NULL;
+        record->extent_num = 0;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t search_record(imn_record_t *record, imn_iso_t *iso,
+        imn_block_buf_t *buf, imn_arena_t *arena, imn_record_t *parent,
+        imn_range_t *global_range) {
+
+    imn_error_t ret_val;
+
+    imn_rawrec_wrapper_t rec_wrapper;
+    imn_raw_record_t *raw_rec;
+    imn_extent_t *cur_extent;
+    imn_range_t local_range;
+
+    bool multi_extent;
+    off_t cur_loc;
+
+    if (record == NULL || iso == NULL || arena == NULL ||
+            global_range == NULL) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+
+    record->extent_list = NULL;
+    record->extent_num = 0;
+
+    local_range.start = global_range->start;
+    local_range.end = global_range->end;
+
+    ret_val = search_raw_record(&rec_wrapper, iso, buf, arena,
+                                    &local_range, true);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    raw_rec = rec_wrapper.raw_rec;
+    if (raw_rec == NULL) {
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    ret_val = handle_lead_extent(record, &rec_wrapper, parent, arena,
+                                    iso->desc->joliet_level > 0);
+    if (ret_val != IMN_OK) {
+        goto exit_wrapper;
+    }
 
     cur_loc = rec_wrapper.rec_offset + raw_rec->len_dr[0];
     multi_extent = (raw_rec->flags[0] & 0x80);
     cur_extent = record->extent_list;
-    free_rec_wrapper(&rec_wrapper);
+    free_rec_wrapper(&rec_wrapper);
+
+    while (multi_extent) {
+
+        local_range.start = cur_loc;
+        ret_val = search_raw_record(&rec_wrapper, iso, buf, arena,
+                                        &local_range, false);
+        if (ret_val != IMN_OK) {
+            goto exit_wrapper;
+        }
+        raw_rec = rec_wrapper.raw_rec;
+
+        // ISO-9660 violation: Addditional extent does not exist
+        if (raw_rec == NULL) {
+            ret_val = IMN_STD_ERR;
+            goto exit_wrapper;
+        }
+
+        cur_extent->link = arena_alloc(arena, sizeof(*cur_extent));
+        if (cur_extent->link == NULL) {
+            ret_val = IMN_ALLOC_ERR;
+            goto exit_wrapper;
+        }
+        cur_extent = cur_extent->link;
+
+        cur_extent->lba_offset = LE_int32(&raw_rec->block[0]);
+        cur_extent->data_length = LE_int32(&raw_rec->length[0]);
+        cur_extent->link = NULL;
+        
+        record->extent_num += 1;
+        record->total_size += cur_extent->data_length;
+
+        cur_loc = rec_wrapper.rec_offset + raw_rec->len_dr[0];
+        record->extent_span.end = cur_loc;
+
+        multi_extent = (raw_rec->flags[0] & 0x80);
+        free_rec_wrapper(&rec_wrapper);
+    }
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    // Extents and identifiers belong to the arena; released on rewind
+    exit_wrapper:
+        free_rec_wrapper(&rec_wrapper);
+    exit_normal:
+        return ret_val;
+}
+
+static
+int64_t days_from_civil(int64_t year, unsigned month, unsigned day) {
+
+    int64_t era;
+    unsigned year_of_era, day_of_year, day_of_era;
+
+    // Proleptic Gregorian day count relative to 1970-01-01
+    year -= (month <= 2);
+    era = (year >= 0 ? year : year - 399) / 400;
+    year_of_era = (unsigned) (year - era * 400);
+    day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+                    day_of_year;
+
+    return era * 146097 + (int64_t) day_of_era - 719468;
+}
+
+static
+time_t civil_time(int year, int month, int day, int hour, int minute,
+        int second, int8_t gmt_offset) {
+
+    int64_t days;
+
+    if (month < 1 || month > 12 || day < 1 || day > 31) {
+        return 0;
+    }
+
+    days = days_from_civil(year, month, day);
+
+    // Offset is stored in 15 minute intervals east of GMT
+    return (time_t) (days * 86400 + hour * 3600 + minute * 60 + second -
+                        (int64_t) gmt_offset * 900);
+}
+
+static
+int ascii_digits(uint8_t *raw, int count) {
+
+    int value, pos;
+
+    value = 0;
+    for (pos = 0; pos < count; pos++) {
+        if (raw[pos] < '0' || raw[pos] > '9') {
+            return 0;
+        }
+        value = value * 10 + (raw[pos] - '0');
+    }
+
+    return value;
+}
+
+static
+time_t decode_time(uint8_t *raw, bool is_long) {
+
+    // 17-byte form is the volume descriptor's ASCII date
+    if (is_long) {
+        return civil_time(ascii_digits(raw, 4), ascii_digits(raw + 4, 2),
+                            ascii_digits(raw + 6, 2), ascii_digits(raw + 8, 2),
+                            ascii_digits(raw + 10, 2),
+                            ascii_digits(raw + 12, 2), (int8_t) raw[16]);
+    }
+
+    return civil_time(1900 + raw[0], raw[1], raw[2], raw[3], raw[4], raw[5],
+                        (int8_t) raw[6]);
+}
+
+static
+imn_error_t append_rr_text(char **text, size_t *length, size_t *cap,
+        char *src, size_t src_len) {
+
+    imn_error_t ret_val;
+
+    ret_val = reserve_items((void **) text, cap, *length + src_len + 1,
+                                sizeof(char));
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    memcpy(*text + *length, src, src_len);
+    *length += src_len;
+    (*text)[*length] = '\0';
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t parse_sl(imn_rr_attr_t *attr, imn_susp_state_t *state,
+        uint8_t *entry, uint8_t entry_len) {
+
+    imn_error_t ret_val;
+    uint8_t comp_flags, comp_len;
+    size_t comp_pos;
+
+    comp_pos = 5;
+    while (!state->link_done && comp_pos + 2 <= entry_len) {
+
+        comp_flags = entry[comp_pos];
+        comp_len = entry[comp_pos + 1];
+
+        if (comp_pos + 2 + comp_len > entry_len) {
+            ret_val = IMN_STD_ERR;
+            goto exit_normal;
+        }
+
+        if (attr->link_length > 0 && !state->link_join) {
+            ret_val = append_rr_text(&attr->link_target, &attr->link_length,
+                                        &state->link_cap, "/", 1);
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
+        }
+
+        if (comp_flags & 0x02) {
+            ret_val = append_rr_text(&attr->link_target, &attr->link_length,
+                                        &state->link_cap, ".", 1);
+        } else if (comp_flags & 0x04) {
+            ret_val = append_rr_text(&attr->link_target, &attr->link_length,
+                                        &state->link_cap, "..", 2);
+        } else if (comp_flags & 0x08) {
+            ret_val = append_rr_text(&attr->link_target, &attr->link_length,
+                                        &state->link_cap, "/", 1);
+        } else {
+            ret_val = append_rr_text(&attr->link_target, &attr->link_length,
+                                        &state->link_cap,
+                                        (char *) entry + comp_pos + 2,
+                                        comp_len);
+        }
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        // Root already ends in a separator; continued parts are glued on
+        state->link_join = (comp_flags & 0x09) != 0;
+        comp_pos += 2 + comp_len;
+    }
+
+    // Without the continue flag the link is complete
+    if (!(entry[4] & 0x01)) {
+        state->link_done = true;
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t parse_susp_area(imn_rr_attr_t *attr, imn_susp_state_t *state,
+        uint8_t *area, size_t area_len) {
+
+    imn_error_t ret_val;
+    uint8_t *entry;
+    uint8_t entry_len, time_flags, time_size;
+    size_t area_pos, time_pos;
+    time_t *time_slot;
+    int time_bit;
+
+    area_pos = 0;
+    while (area_pos + 4 <= area_len) {
+
+        entry = area + area_pos;
+        entry_len = entry[2];
+
+        // Remaining bytes are padding, not a SUSP entry
+        if (entry_len < 4 || area_pos + entry_len > area_len) {
+            break;
+        }
+        area_pos += entry_len;
+
+        if (memcmp(entry, "ST", 2) == 0) {
+            break;
+
+        } else if (memcmp(entry, "CE", 2) == 0 && entry_len >= 28) {
+            state->has_ce = true;
+            state->ce_lba = LE_int32(entry + 4);
+            state->ce_offset = LE_int32(entry + 12);
+            state->ce_length = LE_int32(entry + 20);
+
+        } else if (memcmp(entry, "PX", 2) == 0 && entry_len >= 36) {
+            attr->has_px = true;
+            attr->mode = LE_int32(entry + 4);
+            attr->nlink = LE_int32(entry + 12);
+            attr->uid = LE_int32(entry + 20);
+            attr->gid = LE_int32(entry + 28);
+
+            // Serial number only exists from RRIP 1.12 on
+            if (entry_len >= 44) {
+                attr->ino = LE_int32(entry + 36);
+            }
+
+        } else if (memcmp(entry, "PN", 2) == 0 && entry_len >= 20) {
+            attr->has_pn = true;
+            attr->dev = ((uint64_t) LE_int32(entry + 4) << 32) |
+                            LE_int32(entry + 12);
+
+        } else if (memcmp(entry, "NM", 2) == 0 && entry_len >= 5 &&
+                    !state->name_done) {
+
+            if (entry[4] & 0x02) {
+                ret_val = append_rr_text(&attr->name, &attr->name_length,
+                                            &state->name_cap, ".", 1);
+            } else if (entry[4] & 0x04) {
+                ret_val = append_rr_text(&attr->name, &attr->name_length,
+                                            &state->name_cap, "..", 2);
+            } else {
+                ret_val = append_rr_text(&attr->name, &attr->name_length,
+                                            &state->name_cap,
+                                            (char *) entry + 5, entry_len - 5);
+            }
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
+            state->name_done = !(entry[4] & 0x01);
+
+        } else if (memcmp(entry, "SL", 2) == 0 && entry_len >= 5) {
+            ret_val = parse_sl(attr, state, entry, entry_len);
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
+
+        } else if (memcmp(entry, "TF", 2) == 0 && entry_len >= 5) {
+
+            time_flags = entry[4];
+            time_size = (time_flags & 0x80) ? 17 : 7;
+            time_pos = 5;
+
+            for (time_bit = 0; time_bit < 7; time_bit++) {
+
+                if (!(time_flags & (1 << time_bit))) {
+                    continue;
+                }
+                if (time_pos + time_size > entry_len) {
+                    break;
+                }
+
+                time_slot = NULL;
+                switch (1 << time_bit) {
+                    case RR_TIME_CREATE: time_slot = &attr->create_time; break;
+                    case RR_TIME_MODIFY: time_slot = &attr->modify_time; break;
+                    case RR_TIME_ACCESS: time_slot = &attr->access_time; break;
+                    case RR_TIME_ATTRIB: time_slot = &attr->attrib_time; break;
+                }
+
+                if (time_slot != NULL) {
+                    *time_slot = decode_time(entry + time_pos,
+                                                time_flags & 0x80);
+                    attr->time_flags |= 1 << time_bit;
+                }
+                time_pos += time_size;
+            }
+
+        } else if (memcmp(entry, "RE", 2) == 0) {
+            attr->is_relocated = true;
+
+        } else if (memcmp(entry, "CL", 2) == 0 && entry_len >= 12) {
+            attr->child_lba = LE_int32(entry + 4);
+
+        } else if (memcmp(entry, "PL", 2) == 0 && entry_len >= 12) {
+            attr->parent_lba = LE_int32(entry + 4);
+
+        } else if (memcmp(entry, "ZF", 2) == 0 && entry_len >= 16 &&
+                    memcmp(entry + 4, "pz", 2) == 0) {
+            attr->has_zf = true;
+            attr->zf_block_log2 = entry[7];
+            attr->zf_size = LE_int32(entry + 8);
+        }
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t read_dir_record(imn_iso_t *iso, off_t rec_offset,
+        uint8_t *rec_data, size_t *rec_len) {
+
+    imn_error_t ret_val;
+    uint16_t block_size;
+    size_t read_len;
+
+    // Records never straddle blocks; never read past the current one
+    block_size = iso->desc->block_size;
+    read_len = block_size - rec_offset % block_size;
+    if (read_len > UINT8_MAX) {
+        read_len = UINT8_MAX;
+    }
+
+    ret_val = read_bytes(iso, rec_offset, read_len, rec_data);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    if (rec_data[0] < sizeof(imn_raw_record_t) || rec_data[0] > read_len ||
+            sizeof(imn_raw_record_t) + rec_data[32] > rec_data[0]) {
+        ret_val = IMN_STD_ERR;
+        goto exit_normal;
+    }
+    *rec_len = rec_data[0];
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+size_t su_start(uint8_t *rec_data) {
+
+    uint8_t id_len;
+
+    // Identifier is padded to an even length before the System Use area
+    id_len = rec_data[32];
+    return sizeof(imn_raw_record_t) + id_len + ((id_len & 1) ? 0 : 1);
+}
+
+// SP must open the System Use area of the root's "." record
+static
+bool find_sp(uint8_t *rec_data, size_t rec_len, uint8_t *susp_skip) {
+
+    uint8_t *entry;
+    size_t area_pos;
+
+    area_pos = su_start(rec_data);
+    entry = rec_data + area_pos;
+
+    if (area_pos + 7 > rec_len || memcmp(entry, "SP", 2) != 0 ||
+            entry[2] < 7 || entry[4] != 0xBE || entry[5] != 0xEF) {
+        return false;
+    }
+
+    *susp_skip = entry[6];
+    return true;
+}
+
+static
+void detect_susp(imn_iso_t *iso, imn_vol_desc_t *desc) {
+
+    uint8_t rec_data[UINT8_MAX];
+    size_t rec_len;
+    imn_vol_desc_t *old_desc;
+
+    desc->has_susp = false;
+    desc->susp_skip = 0;
+
+    old_desc = iso->desc;
+    iso->desc = desc;
+
+    if (read_dir_record(iso, (off_t) desc->root_dir->extent_list->lba_offset *
+                            desc->block_size, rec_data, &rec_len) == IMN_OK) {
+        desc->has_susp = find_sp(rec_data, rec_len, &desc->susp_skip);
+    }
+
+    iso->desc = old_desc;
+}
+
+// Checks the PVD's root without opening it; the current descriptor (and
+// so read_dir_record) may belong to another tree and other threads
+static
+bool pvd_has_susp(imn_iso_t *iso) {
+
+    uint8_t desc_data[DESC_SECTOR_SIZE];
+    uint8_t rec_data[UINT8_MAX];
+    imn_raw_vol_t *raw_descriptor;
+    uint8_t *root_rec;
+    uint32_t desc_idx;
+    uint16_t block_size;
+    uint8_t susp_skip;
+
+    for (desc_idx = 0; desc_idx < iso->desc_num; desc_idx++) {
+        if (iso->desc_list[desc_idx].type == DESC_TYPE_PRIMARY) {
+            break;
+        }
+    }
+
+    if (desc_idx == iso->desc_num ||
+            read_bytes(iso, (off_t) iso->desc_list[desc_idx].lba *
+                        DESC_SECTOR_SIZE, DESC_SECTOR_SIZE,
+                        desc_data) != IMN_OK) {
+        return false;
+    }
+
+    raw_descriptor = (imn_raw_vol_t *) desc_data;
+    root_rec = &raw_descriptor->root_dir_record[0];
+    block_size = LE_int16(&raw_descriptor->block_size[0]);
+    if (block_size < UINT8_MAX) {
+        return false;
+    }
+
+    if (read_bytes(iso, (off_t) LE_int32(root_rec + 2) * block_size,
+                    UINT8_MAX, rec_data) != IMN_OK ||
+            rec_data[0] < sizeof(imn_raw_record_t) ||
+            sizeof(imn_raw_record_t) + rec_data[32] > rec_data[0]) {
+        return false;
+    }
+
+    return find_sp(rec_data, rec_data[0], &susp_skip);
+}
+
+imn_error_t imn_get_rr(imn_iso_t *iso, imn_record_t *record,
+        imn_rr_attr_t *attr) {
+
+    imn_error_t ret_val;
+    imn_susp_state_t state;
+
+    uint8_t rec_data[UINT8_MAX];
+    uint8_t *ce_data;
+    size_t rec_len, area_pos;
+    off_t rec_offset;
+    int ce_num;
+
+    if (iso == NULL || record == NULL || attr == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    memset(attr, 0, sizeof(*attr));
+    memset(&state, 0, sizeof(state));
+
+    // Joliet trees carry no SUSP; say so when the PVD would have it
+    if (!iso->desc->has_susp) {
+        ret_val = (iso->desc_list[iso->desc->desc_idx].type !=
+                    DESC_TYPE_PRIMARY && pvd_has_susp(iso)) ?
+                        IMN_RR_DESC_ERR : IMN_EXT_ERR;
+        goto exit_normal;
+    }
+
+    // Index records carry no on-disk location
+    rec_offset = record->extent_span.start;
+    if (rec_offset == 0) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    // Root lives in the descriptor; its attributes sit on its "." record
+    if (rec_offset == iso->desc->root_dir->extent_span.start) {
+        rec_offset = (off_t) iso->desc->root_dir->extent_list->lba_offset *
+                        iso->desc->block_size;
+    }
+
+    ret_val = read_dir_record(iso, rec_offset, rec_data, &rec_len);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    area_pos = su_start(rec_data);
+    if (rec_offset != (off_t) iso->desc->root_dir->extent_list->lba_offset *
+                        iso->desc->block_size) {
+        area_pos += iso->desc->susp_skip;
+    }
+
+    if (area_pos < rec_len) {
+        ret_val = parse_susp_area(attr, &state, rec_data + area_pos,
+                                    rec_len - area_pos);
+        if (ret_val != IMN_OK) {
+            goto exit_attr;
+        }
+    }
+
+    // Continuation areas may chain; bounded against crafted loops
+    for (ce_num = 0; state.has_ce && ce_num < RR_MAX_CE; ce_num++) {
+
+        state.has_ce = false;
+        if (state.ce_length == 0 ||
+                (uint64_t) state.ce_offset + state.ce_length >
+                iso->desc->block_size) {
+            ret_val = IMN_STD_ERR;
+            goto exit_attr;
+        }
+
+        ce_data = malloc(state.ce_length);
+        if (ce_data == NULL) {
+            ret_val = IMN_ALLOC_ERR;
+            goto exit_attr;
+        }
+        STAT_ADD(iso->stats, allocs, 1);
+
+        ret_val = read_bytes(iso, (off_t) state.ce_lba * iso->desc->block_size +
+                                state.ce_offset, state.ce_length, ce_data);
+        if (ret_val == IMN_OK) {
+            ret_val = parse_susp_area(attr, &state, ce_data, state.ce_length);
+        }
+        free(ce_data);
+
+        if (ret_val != IMN_OK) {
+            goto exit_attr;
+        }
+    }
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_attr:
+        imn_free_rr(attr);
+    exit_normal:
+        return ret_val;
+}
+
+void imn_free_rr(imn_rr_attr_t *attr) {
+
+    if (attr == NULL) {
+        return;
+    }
+
+    free(attr->name);
+    free(attr->link_target);
+
+    attr->name = NULL;
+    attr->name_length = 0;
+    attr->link_target = NULL;
+    attr->link_length = 0;
+}
+
+static
+imn_error_t retrieve_desc(imn_vol_desc_t *desc, imn_raw_vol_t *raw_descriptor,
+        off_t loc) {
+
+    imn_error_t ret_val;
+
+    imn_rawrec_wrapper_t rec_wrapper;
+    imn_record_t *root_dir;
+
+    if (desc == NULL || raw_descriptor == NULL || loc < 0) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+
+    desc->block_size = LE_int16(&raw_descriptor->block_size[0]);
+    desc->path_table_size = LE_int32(&raw_descriptor->path_table_size[0]);
+    desc->path_table_lba = LE_int32(&raw_descriptor->l_path_table_pos[0]);
+    desc->lba_size = LE_int32(&raw_descriptor->vol_space_size[0]);
+
+    if (desc->block_size == 0) {
+        ret_val = IMN_STD_ERR;
+        goto exit_normal;
+    }
+
+    root_dir = malloc(sizeof(*root_dir));
+    if (root_dir == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    rec_wrapper.raw_rec = (imn_raw_record_t *) &raw_descriptor->root_dir_record;
+    rec_wrapper.rec_offset = loc + offsetof(imn_raw_vol_t, root_dir_record);
+    rec_wrapper.id_length = 0;
+    rec_wrapper.record_id = "\0";
+
+    ret_val = handle_lead_extent(root_dir, &rec_wrapper, NULL, NULL, true);
+    if (ret_val != IMN_OK) {
+        goto exit_root;
+    }
+    desc->root_dir = root_dir;
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_root:
+        free(root_dir);
+    exit_normal:
+        return ret_val;
+
+}
+
+static
+imn_error_t load_path_table(imn_iso_t *iso, imn_vol_desc_t *desc) {
+
+    imn_error_t ret_val;
+    imn_raw_pt_record_t *raw_pt;
+    imn_pt_entry_t *pt_entry;
+
+    size_t pt_pos, raw_len, id_length, pt_cap, names_cap, names_size;
+    uint8_t *pt_data;
+
+    desc->pt_list = NULL;
+    desc->pt_num = 0;
+    desc->pt_names = NULL;
+
+    if (desc->path_table_size == 0) {
+        ret_val = IMN_STD_ERR;
+        goto exit_normal;
+    }
+
+    pt_data = malloc(desc->path_table_size);
+    if (pt_data == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    ret_val = read_bytes(iso, (off_t) desc->path_table_lba * desc->block_size,
+                            desc->path_table_size, pt_data);
+    if (ret_val != IMN_OK) {
+        goto exit_data;
+    }
+
+    pt_cap = 0;
+    names_cap = 0;
+    names_size = 0;
+
+    pt_pos = 0;
+    while (pt_pos + sizeof(*raw_pt) < desc->path_table_size) {
+
+        raw_pt = (imn_raw_pt_record_t *) (pt_data + pt_pos);
+        raw_len = raw_pt->len_di[0];
+
+        if (raw_len == 0 ||
+                pt_pos + sizeof(*raw_pt) + raw_len > desc->path_table_size) {
+            ret_val = IMN_STD_ERR;
+            goto exit_table;
+        }
+
+        ret_val = reserve_items((void **) &desc->pt_list, &pt_cap,
+                                    desc->pt_num + 1, sizeof(*pt_entry));
+        if (ret_val != IMN_OK) {
+            goto exit_table;
+        }
+
+        ret_val = reserve_items((void **) &desc->pt_names, &names_cap,
+                                    names_size + (raw_len * 3) / 2 + 1, 1);
+        if (ret_val != IMN_OK) {
+            goto exit_table;
+        }
+
+        ret_val = decode_id(iso, (char *) (raw_pt + 1), raw_len,
+                                desc->pt_names + names_size, &id_length);
+        if (ret_val != IMN_OK) {
+            goto exit_table;
+        }
+
+        pt_entry = &desc->pt_list[desc->pt_num];
+        pt_entry->lba = LE_int32(&raw_pt->block[0]);
+        pt_entry->parent = LE_int16(&raw_pt->parent[0]);
+        pt_entry->name_offset = names_size;
+        pt_entry->id_length = id_length;
+
+        names_size += id_length + 1;
+        desc->pt_num++;
+
+        pt_pos += sizeof(*raw_pt) + raw_len + (raw_len & 1);
+    }
+
+    free(pt_data);
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_table:
+        free(desc->pt_list);
+        free(desc->pt_names);
+        desc->pt_list = NULL;
+        desc->pt_names = NULL;
+        desc->pt_num = 0;
+    exit_data:
+        free(pt_data);
+    exit_normal:
+        return ret_val;
+}
+
+static
+void free_desc(imn_vol_desc_t *desc) {
+
+    if (desc == NULL) {
+        return;
+    }
+
+    if (desc->root_dir != NULL) {
+        imn_free_record(desc->root_dir);
+        free(desc->root_dir);
+    }
+
+    free(desc->pt_list);
+    free(desc->pt_names);
+    free(desc);
+}
+
+static
+uint64_t hash_chain(uint64_t hash, uint8_t *data, size_t length) {
+
+    size_t pos;
+
+    for (pos = 0; pos < length; pos++) {
+        hash ^= data[pos];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static
+uint64_t hash_bytes(uint8_t *data, size_t length) {
+    return hash_chain(14695981039346656037ull, data, length);
+}
+
+static
+uint8_t joliet_level(imn_raw_vol_t *raw_descriptor) {
+
+    uint8_t *escape;
+
+    escape = &raw_descriptor->escape_sequences[0];
+    if (escape[0] != '%' || escape[1] != '/') {
+        return 0;
+    }
+
+    switch (escape[2]) {
+        case '@': return 1;
+        case 'C': return 2;
+        case 'E': return 3;
+        default: return 0;
+    }
+}
+
+static
+imn_error_t read_desc_set(imn_iso_t *iso, uint8_t **set_data) {
+
+    imn_error_t ret_val;
+    imn_raw_vol_t *raw_descriptor;
+    imn_desc_entry_t *entry;
+
+    uint8_t *new_data;
+    uint32_t sector_num, read_num, sector_idx;
+    size_t desc_cap;
+    bool is_done;
+
+    *set_data = NULL;
+    iso->desc_list = NULL;
+    iso->desc_num = 0;
+
+    desc_cap = 0;
+    sector_num = 0;
+    is_done = false;
+
+    // Whole set is read front to back in multi-sector chunks
+    while (!is_done && sector_num < DESC_SET_MAX) {
+
+        new_data = realloc(*set_data,
+                    (size_t) (sector_num + DESC_SCAN_NUM) * DESC_SECTOR_SIZE);
+        if (new_data == NULL) {
+            ret_val = IMN_ALLOC_ERR;
+            goto exit_set;
+        }
+        *set_data = new_data;
+
+        read_num = DESC_SCAN_NUM;
+        ret_val = read_bytes(iso,
+                    (off_t) (DESC_SET_LBA + sector_num) * DESC_SECTOR_SIZE,
+                    (size_t) read_num * DESC_SECTOR_SIZE,
+                    *set_data + (size_t) sector_num * DESC_SECTOR_SIZE);
+
+        // Tiny images may end right after the terminator
+        if (ret_val == IMN_ACCESS_ERR) {
+            read_num = 1;
+            ret_val = read_bytes(iso,
+                        (off_t) (DESC_SET_LBA + sector_num) * DESC_SECTOR_SIZE,
+                        DESC_SECTOR_SIZE,
+                        *set_data + (size_t) sector_num * DESC_SECTOR_SIZE);
+        }
+        if (ret_val != IMN_OK) {
+            goto exit_set;
+        }
+
+        for (sector_idx = sector_num; sector_idx < sector_num + read_num;
+                sector_idx++) {
+
+            raw_descriptor = (imn_raw_vol_t *) (*set_data +
+                                (size_t) sector_idx * DESC_SECTOR_SIZE);
+
+            if (memcmp(&raw_descriptor->std_identifier[0], "CD001", 5) != 0) {
+                ret_val = IMN_STD_ERR;
+                goto exit_set;
+            }
+
+            if (raw_descriptor->vol_desc_type[0] == DESC_TYPE_TERMINATOR) {
+                is_done = true;
+                break;
+            }
+
+            ret_val = reserve_items((void **) &iso->desc_list, &desc_cap,
+                                        iso->desc_num + 1, sizeof(*entry));
+            if (ret_val != IMN_OK) {
+                goto exit_set;
+            }
+
+            entry = &iso->desc_list[iso->desc_num++];
+            entry->lba = DESC_SET_LBA + sector_idx;
+            entry->type = raw_descriptor->vol_desc_type[0];
+            entry->version = raw_descriptor->vol_desc_version[0];
+            entry->joliet_level = 0;
+
+            if (entry->type == DESC_TYPE_SUPPLEMENTARY) {
+                entry->joliet_level = joliet_level(raw_descriptor);
+            }
+        }
+        sector_num += read_num;
+    }
+
+    if (!is_done) {
+        ret_val = IMN_STD_ERR;
+        goto exit_set;
+    }
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_set:
+        free(*set_data);
+        *set_data = NULL;
+        free(iso->desc_list);
+        iso->desc_list = NULL;
+        iso->desc_num = 0;
+    exit_normal:
+        return ret_val;
+}
+
+static
+int rank_desc(imn_desc_entry_t *entry) {
+
+    // Joliet keeps full Unicode names; Enhanced beats plain d-characters
+    if (entry->type == DESC_TYPE_SUPPLEMENTARY && entry->joliet_level > 0) {
+        return 3 + entry->joliet_level;
+    }
+
+    if (entry->type == DESC_TYPE_SUPPLEMENTARY && entry->version == 2) {
+        return 2;
+    }
+
+    if (entry->type == DESC_TYPE_PRIMARY) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static
+imn_error_t open_desc(imn_iso_t *iso, imn_raw_vol_t *raw_descriptor,
+        uint32_t desc_idx) {
+
+    imn_error_t ret_val;
+    imn_vol_desc_t *desc, *old_desc;
+
+    desc = calloc(1, sizeof(*desc));
+    if (desc == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    desc->desc_idx = desc_idx;
+    desc->joliet_level = iso->desc_list[desc_idx].joliet_level;
+
+    ret_val = retrieve_desc(desc, raw_descriptor,
+                (off_t) iso->desc_list[desc_idx].lba * DESC_SECTOR_SIZE);
+    if (ret_val != IMN_OK) {
+        goto exit_desc;
+    }
+
+    // Only the SP check is done up front; attributes are read on demand
+    detect_susp(iso, desc);
+
+    // Identifier decoding looks at the descriptor being loaded
+    old_desc = iso->desc;
+    iso->desc = desc;
+
+    // Unusable path table only disables imn_lookup; listings still work
+    ret_val = load_path_table(iso, desc);
+    if (ret_val == IMN_ALLOC_ERR) {
+        iso->desc = old_desc;
+        goto exit_desc;
+    }
+
+    free_desc(old_desc);
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_desc:
+        free_desc(desc);
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t init_desc(imn_iso_t *iso) {
+
+    imn_error_t ret_val;
+    uint8_t *set_data;
+    uint32_t desc_idx, best_idx;
+    int best_rank, cur_rank;
+
+    iso->desc = NULL;
+
+    ret_val = read_desc_set(iso, &set_data);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    best_idx = 0;
+    best_rank = 0;
+    for (desc_idx = 0; desc_idx < iso->desc_num; desc_idx++) {
+
+        cur_rank = rank_desc(&iso->desc_list[desc_idx]);
+        if (cur_rank > best_rank) {
+            best_rank = cur_rank;
+            best_idx = desc_idx;
+        }
+    }
+
+    if (best_rank == 0) {
+        ret_val = IMN_STD_ERR;
+        goto exit_set;
+    }
+
+    // Descriptors carry volume ids and dates; good enough as a fingerprint
+    iso->desc_hash = hash_bytes(set_data,
+                        (size_t) (iso->desc_num + 1) * DESC_SECTOR_SIZE);
+    iso->image_key = iso->desc_hash ^
+                        (iso->image_size * 0x9E3779B97F4A7C15ull) ^
+                        ((uint64_t) iso->image_mtime << 1);
+
+    ret_val = open_desc(iso, (imn_raw_vol_t *) (set_data +
+                (size_t) (iso->desc_list[best_idx].lba - DESC_SET_LBA) *
+                DESC_SECTOR_SIZE), best_idx);
+    if (ret_val != IMN_OK) {
+        goto exit_set;
+    }
+
+    free(set_data);
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_set:
+        free(set_data);
+        free(iso->desc_list);
+        iso->desc_list = NULL;
+        iso->desc_num = 0;
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_use_desc(imn_iso_t *iso, uint32_t desc_idx) {
+
+    imn_error_t ret_val;
+    imn_raw_vol_t raw_descriptor;
+
+    if (iso == NULL || iso->desc == NULL || desc_idx >= iso->desc_num ||
+            rank_desc(&iso->desc_list[desc_idx]) == 0) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    ret_val = read_bytes(iso,
+                (off_t) iso->desc_list[desc_idx].lba * DESC_SECTOR_SIZE,
+                sizeof(raw_descriptor), (uint8_t *) &raw_descriptor);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    ret_val = open_desc(iso, &raw_descriptor, desc_idx);
+
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_init(imn_iso_t *iso, char *iso_path, bool is_header) {
+
+    imn_error_t ret_val;
+    struct stat iso_stat;
+    int iso_fd;
+
+    if (iso == NULL || iso_path == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    iso_fd = open(iso_path, O_RDONLY | O_CLOEXEC);
+    if (iso_fd == -1) {
+        ret_val = IMN_PATH_ERR;
+        goto exit_normal;
+    }
+
+    if (fstat(iso_fd, &iso_stat) == -1) {
+        ret_val = IMN_ACCESS_ERR;
+        goto exit_fd;
+    }
+
+    iso->is_header = is_header;
+    iso->iso_fd = iso_fd;
+    iso->iso_map = NULL;
+    iso->map_size = 0;
+    iso->image_size = iso_stat.st_size;
+    iso->image_mtime = iso_stat.st_mtime;
+    iso->cache = NULL;
+    iso->stats = NULL;
+    iso->trace = NULL;
+
+#ifdef IMN_IO_URING
+    pthread_mutex_init(&iso->ring_lock, NULL);
+    iso->ring = NULL;
+    iso->ring_failed = false;
+#endif
+
+    ret_val = init_desc(iso);
+    if (ret_val != IMN_OK) {
+        goto exit_fd;
+    }
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_fd:
+#ifdef IMN_IO_URING
+        uring_drop(iso);
+        pthread_mutex_destroy(&iso->ring_lock);
+#endif
+        close(iso_fd);
+        iso->iso_fd = -1;
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_init_mmap(imn_iso_t *iso, char *iso_path, bool is_header) {
+
+    imn_error_t ret_val;
+    struct stat iso_stat;
+    uint8_t *iso_map;
+    int iso_fd;
+
+    if (iso == NULL || iso_path == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    iso_fd = open(iso_path, O_RDONLY | O_CLOEXEC);
+    if (iso_fd == -1) {
+        ret_val = IMN_PATH_ERR;
+        goto exit_normal;
+    }
+
+    if (fstat(iso_fd, &iso_stat) == -1 || iso_stat.st_size <= 0) {
+        ret_val = IMN_ACCESS_ERR;
+        goto exit_fd;
+    }
+
+    iso_map = mmap(NULL, iso_stat.st_size, PROT_READ, MAP_PRIVATE, iso_fd, 0);
+    if (iso_map == MAP_FAILED) {
+        ret_val = IMN_ACCESS_ERR;
+        goto exit_fd;
+    }
+
+    iso->is_header = is_header;
+    iso->iso_fd = -1;
+    iso->iso_map = iso_map;
+    iso->map_size = iso_stat.st_size;
+    iso->image_size = iso_stat.st_size;
+    iso->image_mtime = iso_stat.st_mtime;
+    iso->cache = NULL;
+    iso->stats = NULL;
+    iso->trace = NULL;
+
+    ret_val = init_desc(iso);
+    if (ret_val != IMN_OK) {
+        goto exit_map;
+    }
+
+    // Mapping stays valid once the descriptor is closed
+    close(iso_fd);
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_map:
+        munmap(iso_map, iso_stat.st_size);
+        iso->iso_map = NULL;
+        iso->map_size = 0;
+    exit_fd:
+        close(iso_fd);
+    exit_normal:
+        return ret_val;
+}
+
+void imn_close(imn_iso_t *iso) {
+
+    if (iso == NULL) {
+        return;
+    }
+
+    free_desc(iso->desc);
+    iso->desc = NULL;
+
+    free(iso->desc_list);
+    iso->desc_list = NULL;
+    iso->desc_num = 0;
+
+    if (iso->iso_map != NULL) {
+        munmap(iso->iso_map, iso->map_size);
+        iso->iso_map = NULL;
+        iso->map_size = 0;
+    }
+
+    if (iso->iso_fd != -1) {
+#ifdef IMN_IO_URING
+        uring_drop(iso);
+        pthread_mutex_destroy(&iso->ring_lock);
+#endif
+        close(iso->iso_fd);
+        iso->iso_fd = -1;
+    }
+}
+
+static
+imn_error_t build_path(imn_record_t *record, char *buffer, size_t buffer_size,
+        size_t *path_len) {
+
+    imn_error_t ret_val;
+    imn_record_t *cur_dir;
+    size_t str_pos, total_len;
+
+    // Measure first so segments can be written back to front in place
+    total_len = 0;
+    for (cur_dir = record; cur_dir != NULL; cur_dir = cur_dir->parent_dir) {
+        if (cur_dir->id_length != 0) {
+            total_len += cur_dir->id_length + 1;
+        }
+    }
+
+    if (total_len > buffer_size || buffer_size == 0) {
+        ret_val = IMN_MEM_ERR;
+        goto exit_normal;
+    }
+
+    str_pos = (total_len > 0) ? total_len - 1 : 0;
+    buffer[str_pos] = '\0';
+    *path_len = str_pos;
+
+    for (cur_dir = record; cur_dir != NULL; cur_dir = cur_dir->parent_dir) {
+
+        if (cur_dir->id_length == 0) {
+            continue;
+        }
+
+        if (str_pos < *path_len) {
+            buffer[--str_pos] = '/';
+        }
+
+        str_pos -= cur_dir->id_length;
+        memcpy(buffer + str_pos, cur_dir->record_id, cur_dir->id_length);
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t append_path(imn_path_buf_t *path, char *segment, size_t length,
+        bool is_dir) {
+
+    imn_error_t ret_val;
+
+    ret_val = reserve_items((void **) &path->buffer, &path->cap,
+                                path->length + length + 2, sizeof(char));
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    memcpy(path->buffer + path->length, segment, length);
+    path->length += length;
+
+    if (is_dir) {
+        path->buffer[path->length++] = '/';
+    }
+    path->buffer[path->length] = '\0';
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t traverse_scope(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_callback_t *callback, imn_path_buf_t *path, bool recursive,
+        imn_arena_t *arena) {
+    
+    imn_error_t ret_val;
+
+    imn_extent_t *cur_extent;
+    imn_record_t cur_record;
+    imn_block_buf_t block_buf;
+    imn_arena_mark_t scope_mark;
+    imn_range_t range;
+
+    uint16_t block_size;
+    size_t prefix_len;
+
+    int call_ret;
+
+    if (!dir_record->is_dir) {
+        ret_val = IMN_DIR_ERR;
+        goto exit_normal;
+    }
+
+    block_size = iso->desc->block_size;
+    cur_extent = dir_record->extent_list;
+
+    // One buffered block per directory scope; survives nested recursion
+    ret_val = init_block_buf(iso, &block_buf);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+    scan_begin(iso, dir_record);
+
+    // Everything decoded past this mark is dropped once an entry is done
+    scope_mark = arena_mark(arena);
+    prefix_len = (path != NULL) ? path->length : 0;
+
+    // Handle multi-extent dirs
+    while (cur_extent != NULL) {
+
+        range.start = (off_t) cur_extent->lba_offset * block_size;
+        range.end = range.start + cur_extent->data_length;
+
+        // Records are scanned front to back; read the extent in big windows
+        ret_val = set_read_window(iso, &block_buf, cur_extent->lba_offset,
+                    (cur_extent->data_length + block_size - 1) / block_size);
+        if (ret_val != IMN_OK) {
+            goto exit_buf;
+        }
+
+        while (range.start < range.end) {
+
+            ret_val = search_record(&cur_record, iso, &block_buf, arena,
+                                        dir_record, &range);
+            if (ret_val != IMN_OK) {
+                goto exit_buf;
+            }
+
+            if (cur_record.extent_num == 0) break;
+            range.start = cur_record.extent_span.end;
+
+            if (!cur_record.is_dir) {
+
+                if (path != NULL) {
+
+                    // Prefix stays put; only the leaf name is rewritten
+                    ret_val = append_path(path, cur_record.record_id,
+                                            cur_record.id_length, false);
+                    if (ret_val != IMN_OK) {
+                        goto exit_buf;
+                    }
+
+                    call_ret = path->callback->fn(&cur_record, path->buffer,
+                                    path->length, path->callback->args);
+                    path->length = prefix_len;
+
+                } else {
+                    call_ret = callback->fn(&cur_record, callback->args);
+                }
+
+                if (call_ret < 0) {
+                    ret_val = IMN_CALLBACK_ERR;
+                    goto exit_buf;
+                }
+
+            } else if (recursive &&
+                        cur_record.record_id[0] != '\0' &&
+                        cur_record.record_id[0] != '\1') {
+
+                if (path != NULL) {
+                    ret_val = append_path(path, cur_record.record_id,
+                                            cur_record.id_length, true);
+                    if (ret_val != IMN_OK) {
+                        goto exit_buf;
+                    }
+                }
+
+                ret_val = traverse_scope(iso, &cur_record, callback, path,
+                                            recursive, arena);
+
+                if (ret_val != IMN_OK) {
+                    goto exit_buf;
+                }
+
+                if (path != NULL) {
+                    path->length = prefix_len;
+                }
+            }
+
+            arena_rewind(arena, scope_mark);
+        }
+        cur_extent = cur_extent->link;        
+    }
+
+    ret_val = IMN_OK;
+    exit_buf:
+        scan_end(iso, dir_record, ret_val);
+        arena_rewind(arena, scope_mark);
+        free_block_buf(&block_buf);
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_traverse_dir(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_callback_t *callback, bool recursive) {
+    
+    imn_error_t ret_val;
+    imn_arena_t arena;
+
+    if (iso == NULL || dir_record == NULL || callback == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    // Single arena per traversal; each directory scope rewinds its share
+    init_arena(&arena, iso->stats);
+
+    ret_val = traverse_scope(iso, dir_record, callback, NULL, recursive,
+                                &arena);
+    free_arena(&arena);
+
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_traverse_paths(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_path_callback_t *callback, bool recursive) {
+
+    imn_error_t ret_val;
+    imn_arena_t arena;
+    imn_path_buf_t path;
+
+    if (iso == NULL || dir_record == NULL || callback == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    path.buffer = NULL;
+    path.length = 0;
+    path.cap = 0;
+    path.callback = callback;
+
+    // Seed with the starting directory so paths match imn_get_path
+    while ((ret_val = build_path(dir_record, path.buffer, path.cap,
+                &path.length)) == IMN_MEM_ERR) {
+
+        ret_val = reserve_items((void **) &path.buffer, &path.cap,
+                                    path.cap + 1, sizeof(char));
+        if (ret_val != IMN_OK) {
+            goto exit_path;
+        }
+    }
+
+    if (path.length > 0) {
+        ret_val = append_path(&path, "", 0, true);
+        if (ret_val != IMN_OK) {
+            goto exit_path;
+        }
+    }
+
+    init_arena(&arena, iso->stats);
+
+    ret_val = traverse_scope(iso, dir_record, NULL, &path, recursive,
+                                &arena);
+    free_arena(&arena);
+
+    exit_path:
+        free(path.buffer);
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t flush_batch(imn_entry_batch_t *batch,
+        imn_batch_callback_t *callback) {
+
+    imn_error_t ret_val;
+    int call_ret;
+
+    if (batch->entry_num > 0) {
+
+        call_ret = callback->fn(batch, callback->args);
+        if (call_ret < 0) {
+            ret_val = IMN_CALLBACK_ERR;
+            goto exit_normal;
+        }
+    }
+
+    batch->entry_num = 0;
+    batch->pool_used = 0;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t batch_add_entry(imn_entry_batch_t *batch,
+        imn_batch_callback_t *callback, imn_record_t *record) {
+
+    imn_error_t ret_val;
+    uint32_t entry_idx;
+
+    if (batch->entry_num == batch->entry_cap ||
+            batch->pool_size - batch->pool_used < record->id_length + 1) {
+
+        ret_val = flush_batch(batch, callback);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        // Name cannot fit even in an empty pool
+        if (batch->pool_size < record->id_length + 1) {
+            ret_val = IMN_MEM_ERR;
+            goto exit_normal;
+        }
+    }
+
+    entry_idx = batch->entry_num++;
+
+    batch->lba_list[entry_idx] = record->extent_list->lba_offset;
+    batch->size_list[entry_idx] = record->total_size;
+    batch->flag_list[entry_idx] =
+        (record->is_hidden ? ENTRY_HIDDEN : 0) |
+        ((record->extent_num > 1) ? ENTRY_MULTI_EXTENT : 0);
+
+    batch->name_offsets[entry_idx] = batch->pool_used;
+    batch->name_lengths[entry_idx] = record->id_length;
+
+    memcpy(batch->name_pool + batch->pool_used, record->record_id,
+            record->id_length);
+    batch->pool_used += record->id_length;
+    batch->name_pool[batch->pool_used++] = '\0';
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t batch_scope(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_entry_batch_t *batch, imn_batch_callback_t *callback,
+        bool recursive, imn_arena_t *arena) {
+
+    imn_error_t ret_val;
+
+    imn_extent_t *cur_extent;
+    imn_record_t cur_record;
+    imn_block_buf_t block_buf;
+    imn_arena_mark_t scope_mark;
+    imn_range_t range;
+
+    uint16_t block_size;
+
+    if (!dir_record->is_dir) {
+        ret_val = IMN_DIR_ERR;
+        goto exit_normal;
+    }
+
+    block_size = iso->desc->block_size;
+    cur_extent = dir_record->extent_list;
+
+    ret_val = init_block_buf(iso, &block_buf);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+    scan_begin(iso, dir_record);
+
+    scope_mark = arena_mark(arena);
+    batch->dir_record = dir_record;
+
+    while (cur_extent != NULL) {
+
+        range.start = (off_t) cur_extent->lba_offset * block_size;
+        range.end = range.start + cur_extent->data_length;
+
+        ret_val = set_read_window(iso, &block_buf, cur_extent->lba_offset,
+                    (cur_extent->data_length + block_size - 1) / block_size);
+        if (ret_val != IMN_OK) {
+            goto exit_buf;
+        }
+
+        while (range.start < range.end) {
+
+            ret_val = search_record(&cur_record, iso, &block_buf, arena,
+                                        dir_record, &range);
+            if (ret_val != IMN_OK) {
+                goto exit_buf;
+            }
+
+            if (cur_record.extent_num == 0) break;
+            range.start = cur_record.extent_span.end;
+
+            if (!cur_record.is_dir) {
+                ret_val = batch_add_entry(batch, callback, &cur_record);
+                if (ret_val != IMN_OK) {
+                    goto exit_buf;
+                }
+
+            } else if (recursive &&
+                        cur_record.record_id[0] != '\0' &&
+                        cur_record.record_id[0] != '\1') {
+
+                // A batch never mixes entries from different directories
+                ret_val = flush_batch(batch, callback);
+                if (ret_val != IMN_OK) {
+                    goto exit_buf;
+                }
+
+                ret_val = batch_scope(iso, &cur_record, batch, callback,
+                                        recursive, arena);
+                if (ret_val != IMN_OK) {
+                    goto exit_buf;
+                }
+                batch->dir_record = dir_record;
+            }
+
+            arena_rewind(arena, scope_mark);
+        }
+        cur_extent = cur_extent->link;
+    }
+
+    ret_val = flush_batch(batch, callback);
+
+    exit_buf:
+        scan_end(iso, dir_record, ret_val);
+        arena_rewind(arena, scope_mark);
+        free_block_buf(&block_buf);
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_traverse_batch(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_entry_batch_t *batch, imn_batch_callback_t *callback,
+        bool recursive) {
+
+    imn_error_t ret_val;
+    imn_arena_t arena;
+
+    if (iso == NULL || dir_record == NULL || batch == NULL ||
+            callback == NULL || batch->entry_cap == 0) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    batch->entry_num = 0;
+    batch->pool_used = 0;
+
+    init_arena(&arena, iso->stats);
+
+    ret_val = batch_scope(iso, dir_record, batch, callback, recursive,
+                            &arena);
+    free_arena(&arena);
+
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_init_batch(imn_entry_batch_t *batch, uint32_t entry_cap,
+        size_t pool_size) {
+
+    imn_error_t ret_val;
+
+    if (batch == NULL || entry_cap == 0 || pool_size == 0) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    memset(batch, 0, sizeof(*batch));
+
+    batch->lba_list = malloc(entry_cap * sizeof(*batch->lba_list));
+    batch->size_list = malloc(entry_cap * sizeof(*batch->size_list));
+    batch->flag_list = malloc(entry_cap * sizeof(*batch->flag_list));
+    batch->name_offsets = malloc(entry_cap * sizeof(*batch->name_offsets));
+    batch->name_lengths = malloc(entry_cap * sizeof(*batch->name_lengths));
+    batch->name_pool = malloc(pool_size);
+
+    if (batch->lba_list == NULL || batch->size_list == NULL ||
+            batch->flag_list == NULL || batch->name_offsets == NULL ||
+            batch->name_lengths == NULL || batch->name_pool == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_batch;
+    }
+
+    batch->entry_cap = entry_cap;
+    batch->pool_size = pool_size;
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_batch:
+        imn_free_batch(batch);
+    exit_normal:
+        return ret_val;
+}
+
+void imn_free_batch(imn_entry_batch_t *batch) {
+
+    if (batch == NULL) {
+        return;
+    }
+
+    free(batch->lba_list);
+    free(batch->size_list);
+    free(batch->flag_list);
+    free(batch->name_offsets);
+    free(batch->name_lengths);
+    free(batch->name_pool);
+
+    memset(batch, 0, sizeof(*batch));
+}
+
+static
+imn_error_t dir_enter_extent(imn_dir_t *dir) {
+
+    uint16_t block_size;
+
+    block_size = dir->iso->desc->block_size;
+
+    dir->range.start = (off_t) dir->cur_extent->lba_offset * block_size;
+    dir->range.end = dir->range.start + dir->cur_extent->data_length;
+
+    return set_read_window(dir->iso, &dir->block_buf,
+                dir->cur_extent->lba_offset,
+                (dir->cur_extent->data_length + block_size - 1) / block_size);
+}
+
+imn_error_t imn_dir_open(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_dir_t *dir) {
+
+    imn_error_t ret_val;
+
+    if (iso == NULL || dir_record == NULL || dir == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    if (!dir_record->is_dir) {
+        ret_val = IMN_DIR_ERR;
+        goto exit_normal;
+    }
+
+    dir->iso = iso;
+    dir->dir_record = dir_record;
+    dir->cur_extent = dir_record->extent_list;
+    dir->range.start = 0;
+    dir->range.end = 0;
+
+    init_arena(&dir->arena, iso->stats);
+    dir->entry_mark = arena_mark(&dir->arena);
+
+    ret_val = init_block_buf(iso, &dir->block_buf);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    if (dir->cur_extent != NULL) {
+        ret_val = dir_enter_extent(dir);
+        if (ret_val != IMN_OK) {
+            goto exit_buf;
+        }
+    }
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_buf:
+        free_block_buf(&dir->block_buf);
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_dir_next(imn_dir_t *dir, imn_record_t **record) {
+
+    imn_error_t ret_val;
+    imn_record_t *cur_record;
+
+    if (dir == NULL || record == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    *record = NULL;
+    cur_record = &dir->record;
+
+    // Previous entry is released here; callers copy what they keep
+    arena_rewind(&dir->arena, dir->entry_mark);
+
+    while (dir->cur_extent != NULL) {
+
+        if (dir->range.start >= dir->range.end) {
+
+            dir->cur_extent = dir->cur_extent->link;
+            if (dir->cur_extent == NULL) {
+                break;
+            }
+
+            ret_val = dir_enter_extent(dir);
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
+            continue;
+        }
+
+        ret_val = search_record(cur_record, dir->iso, &dir->block_buf,
+                                    &dir->arena, dir->dir_record, &dir->range);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        // Rest of the extent is padding; move on to the next one
+        if (cur_record->extent_num == 0) {
+            dir->range.start = dir->range.end;
+            continue;
+        }
+        dir->range.start = cur_record->extent_span.end;
+
+        // Self and parent entries are not directory contents
+        if (cur_record->is_dir &&
+                (cur_record->record_id[0] == '\0' ||
+                 cur_record->record_id[0] == '\1')) {
+            arena_rewind(&dir->arena, dir->entry_mark);
+            continue;
+        }
+
+        *record = cur_record;
+        break;
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+void imn_dir_close(imn_dir_t *dir) {
+
+    if (dir == NULL) {
+        return;
+    }
+
+    free_block_buf(&dir->block_buf);
+    free_arena(&dir->arena);
+    dir->cur_extent = NULL;
+}
+
+static
+imn_error_t clone_record(imn_record_t *dst, imn_record_t *src,
+        imn_arena_t *arena) {
+
+    imn_error_t ret_val;
+    imn_extent_t *src_extent, *cur_extent, **link;
+
+    *dst = *src;
+    dst->parent_dir = NULL;
+    dst->extent_list = NULL;
+    dst->record_id = NULL;
+
+    link = &dst->extent_list;
+    for (src_extent = src->extent_list; src_extent != NULL;
+            src_extent = src_extent->link) {
+
+        cur_extent = alloc_from(arena, sizeof(*cur_extent));
+        if (cur_extent == NULL) {
+            ret_val = IMN_ALLOC_ERR;
+            goto exit_clone;
+        }
+
+        cur_extent->lba_offset = src_extent->lba_offset;
+        cur_extent->data_length = src_extent->data_length;
+        cur_extent->link = NULL;
+
+        *link = cur_extent;
+        link = &cur_extent->link;
+    }
+
+    dst->record_id = alloc_from(arena, src->id_length + 1);
+    if (dst->record_id == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_clone;
+    }
+    memcpy(dst->record_id, src->record_id, src->id_length);
+    dst->record_id[src->id_length] = '\0';
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_clone:
+        if (arena == NULL) {
+            imn_free_record(dst);
+        }
+    exit_normal:
+        return ret_val;
+}
+
+static
+void split_id(char *id, size_t length, size_t *name_len, char **ext,
+        size_t *ext_len, long *version) {
+
+    char *dot;
+    size_t base_len, pos;
+
+    // ";<digits>" version; -1 when absent (e.g. lookup keys, directories)
+    base_len = strip_version(id, length, true);
+    *version = -1;
+    if (base_len < length) {
+        *version = 0;
+        for (pos = base_len + 1; pos < length; pos++) {
+            *version = *version * 10 + (id[pos] - '0');
+        }
+    }
+
+    dot = memchr(id, '.', base_len);
+    if (dot == NULL) {
+        *name_len = base_len;
+        *ext = id + base_len;
+        *ext_len = 0;
+    } else {
+        *name_len = dot - id;
+        *ext = dot + 1;
+        *ext_len = base_len - *name_len - 1;
+    }
+}
+
+static
+int compare_padded(char *part_a, size_t len_a, char *part_b, size_t len_b) {
+
+    size_t pos;
+    uint8_t char_a, char_b;
+
+    // The shorter part is treated as if padded with 0x20
+    for (pos = 0; pos < len_a || pos < len_b; pos++) {
+        char_a = (pos < len_a) ? (uint8_t) part_a[pos] : 0x20;
+        char_b = (pos < len_b) ? (uint8_t) part_b[pos] : 0x20;
+
+        if (char_a != char_b) {
+            return (char_a < char_b) ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+// ECMA-119 9.3 collation: name, then extension, then version descending
+static
+int compare_ids(char *id_a, size_t len_a, char *id_b, size_t len_b) {
+
+    char *ext_a, *ext_b;
+    size_t name_a, name_b, ext_len_a, ext_len_b;
+    long ver_a, ver_b;
+    int cmp_ret;
+
+    split_id(id_a, len_a, &name_a, &ext_a, &ext_len_a, &ver_a);
+    split_id(id_b, len_b, &name_b, &ext_b, &ext_len_b, &ver_b);
+
+    cmp_ret = compare_padded(id_a, name_a, id_b, name_b);
+    if (cmp_ret != 0) {
+        return cmp_ret;
+    }
+
+    cmp_ret = compare_padded(ext_a, ext_len_a, ext_b, ext_len_b);
+    if (cmp_ret != 0) {
+        return cmp_ret;
+    }
+
+    // A key without a version matches any version of the name
+    if (ver_a < 0 || ver_b < 0) {
+        return 0;
+    }
+
+    return (ver_a < ver_b) - (ver_a > ver_b);
+}
+
+static
+imn_error_t block_first_id(imn_iso_t *iso, imn_block_buf_t *buf,
+        imn_arena_t *arena, off_t block_start, imn_rawrec_wrapper_t *rec_wrapper) {
+
+    imn_range_t range;
+
+    range.start = block_start;
+    range.end = block_start + buf->block_size;
+
+    // Records never straddle blocks, so every block starts on a record
+    return search_raw_record(rec_wrapper, iso, buf, arena, &range, true);
+}
+
+static
+char *copy_id(imn_arena_t *arena, imn_rawrec_wrapper_t *rec_wrapper) {
+
+    char *id_copy;
+
+    // In-place identifiers die with the block buffer; keep our own copy
+    id_copy = arena_alloc(arena, rec_wrapper->id_length + 1);
+    if (id_copy != NULL) {
+        memcpy(id_copy, rec_wrapper->record_id, rec_wrapper->id_length);
+        id_copy[rec_wrapper->id_length] = '\0';
+    }
+
+    return id_copy;
+}
+
+static
+imn_error_t search_sorted_dir(imn_iso_t *iso, imn_block_buf_t *buf,
+        imn_arena_t *arena, imn_range_t *dir_range, char *key, size_t key_len,
+        off_t *rec_offset, bool *is_sorted) {
+
+    imn_error_t ret_val;
+    imn_rawrec_wrapper_t rec_wrapper;
+    imn_arena_mark_t probe_mark;
+    imn_range_t range;
+
+    uint32_t block_lo, block_hi, block_mid;
+    uint16_t block_size;
+    char *lo_id, *hi_id, *prev_id, *id_copy;
+    size_t lo_len, hi_len, prev_len;
+    off_t block_end;
+    bool is_passed;
+    int cmp_ret;
+
+    block_size = buf->block_size;
+    *rec_offset = -1;
+    *is_sorted = true;
+
+    // Find the last block whose first identifier sorts below the key
+    block_lo = 0;
+    block_hi = (dir_range->end - dir_range->start + block_size - 1) /
+                    block_size;
+    probe_mark = arena_mark(arena);
+
+    // Probed first identifiers must stay between the bracketing ones
+    lo_id = NULL;
+    hi_id = NULL;
+    lo_len = 0;
+    hi_len = 0;
+
+    while (block_hi - block_lo > 1) {
+
+        block_mid = block_lo + (block_hi - block_lo) / 2;
+
+        ret_val = block_first_id(iso, buf, arena,
+                    dir_range->start + (off_t) block_mid * block_size,
+                    &rec_wrapper);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        if (rec_wrapper.raw_rec == NULL) {
+            block_hi = block_mid;
+            continue;
+        }
+
+        if ((lo_id != NULL && compare_ids(rec_wrapper.record_id,
+                                rec_wrapper.id_length, lo_id, lo_len) < 0) ||
+                (hi_id != NULL && compare_ids(rec_wrapper.record_id,
+                                rec_wrapper.id_length, hi_id, hi_len) > 0)) {
+            *is_sorted = false;
+            ret_val = IMN_OK;
+            goto exit_normal;
+        }
+
+        cmp_ret = compare_ids(rec_wrapper.record_id, rec_wrapper.id_length,
+                                key, key_len);
+
+        id_copy = copy_id(arena, &rec_wrapper);
+        if (id_copy == NULL) {
+            ret_val = IMN_ALLOC_ERR;
+            goto exit_normal;
+        }
+
+        if (cmp_ret < 0) {
+            block_lo = block_mid;
+            lo_id = id_copy;
+            lo_len = rec_wrapper.id_length;
+        } else {
+            block_hi = block_mid;
+            hi_id = id_copy;
+            hi_len = rec_wrapper.id_length;
+        }
+    }
+
+    // Scan forward until the sort order passes the key
+    range.start = dir_range->start + (off_t) block_lo * block_size;
+    range.end = dir_range->end;
+    prev_id = NULL;
+    prev_len = 0;
+    is_passed = false;
+
+    while (range.start < range.end) {
+
+        ret_val = search_raw_record(&rec_wrapper, iso, buf, arena,
+                                        &range, true);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        if (rec_wrapper.raw_rec == NULL) break;
+        range.start = rec_wrapper.rec_offset + rec_wrapper.raw_rec->len_dr[0];
+
+        if (prev_id != NULL && compare_ids(rec_wrapper.record_id,
+                                rec_wrapper.id_length, prev_id,
+                                prev_len) < 0) {
+            *is_sorted = false;
+            break;
+        }
+
+        if (!is_passed) {
+
+            cmp_ret = compare_ids(rec_wrapper.record_id,
+                                    rec_wrapper.id_length, key, key_len);
+            if (cmp_ret == 0) {
+                *rec_offset = rec_wrapper.rec_offset;
+                break;
+            }
+
+            // Past the key; the rest of this block is loaded, so its order
+            // is checked for free before the miss is trusted
+            if (cmp_ret > 0) {
+                is_passed = true;
+                block_end = (rec_wrapper.rec_offset / block_size + 1) *
+                                block_size;
+                if (block_end < range.end) {
+                    range.end = block_end;
+                }
+            }
+        }
+
+        // Records only run up to the key's block, so the copies stay few
+        prev_id = copy_id(arena, &rec_wrapper);
+        prev_len = rec_wrapper.id_length;
+        if (prev_id == NULL) {
+            ret_val = IMN_ALLOC_ERR;
+            goto exit_normal;
+        }
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        arena_rewind(arena, probe_mark);
+        return ret_val;
+}
+
+static
+imn_error_t scan_unsorted_dir(imn_iso_t *iso, imn_block_buf_t *buf,
+        imn_arena_t *arena, imn_range_t *dir_range, char *key, size_t key_len,
+        off_t *rec_offset) {
+
+    imn_error_t ret_val;
+    imn_rawrec_wrapper_t rec_wrapper;
+    imn_arena_mark_t scan_mark;
+    imn_range_t range;
+
+    uint16_t block_size;
+    int cmp_ret;
+
+    block_size = buf->block_size;
+    *rec_offset = -1;
+    scan_mark = arena_mark(arena);
+
+    // Whole extent is read ahead in windows, like a traversal would
+    ret_val = set_read_window(iso, buf, dir_range->start / block_size,
+                (dir_range->end - dir_range->start + block_size - 1) /
+                    block_size);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    range = *dir_range;
+
+    while (range.start < range.end) {
+
+        ret_val = search_raw_record(&rec_wrapper, iso, buf, arena,
+                                        &range, true);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        if (rec_wrapper.raw_rec == NULL) break;
+        range.start = rec_wrapper.rec_offset + rec_wrapper.raw_rec->len_dr[0];
+
+        cmp_ret = compare_ids(rec_wrapper.record_id, rec_wrapper.id_length,
+                                key, key_len);
+        arena_rewind(arena, scan_mark);
+
+        if (cmp_ret == 0) {
+            *rec_offset = rec_wrapper.rec_offset;
+            break;
+        }
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        arena_rewind(arena, scan_mark);
+        return ret_val;
+}
+
+static
+imn_error_t find_in_dir(imn_iso_t *iso, uint32_t dir_lba,
+        char *name, size_t length, imn_record_t *record) {
+
+    imn_error_t ret_val;
+
+    imn_block_buf_t block_buf;
+    imn_record_t cur_record;
+    imn_arena_t arena;
+    imn_range_t range;
+
+    uint16_t block_size;
+    off_t rec_offset;
+    bool is_sorted;
+
+    block_size = iso->desc->block_size;
+
+    ret_val = init_block_buf(iso, &block_buf);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+    init_arena(&arena, iso->stats);
+
+    // Path table only knows the LBA; the self record carries the size
+    range.start = (off_t) dir_lba * block_size;
+    range.end = range.start + block_size;
+
+    ret_val = search_record(&cur_record, iso, &block_buf, &arena,
+                                NULL, &range);
+    if (ret_val != IMN_OK) {
+        goto exit_scan;
+    }
+
+    if (cur_record.extent_num == 0 || !cur_record.is_dir) {
+        ret_val = IMN_STD_ERR;
+        goto exit_scan;
+    }
+    range.end = range.start + cur_record.total_size;
+
+    // Collation ignores versions, so "name", "name;1" and "NAME.;1" all match
+    ret_val = search_sorted_dir(iso, &block_buf, &arena, &range,
+                                    name, length, &rec_offset, &is_sorted);
+    if (ret_val != IMN_OK) {
+        goto exit_scan;
+    }
+
+    // Some mastering tools sort differently; only those pay for a full scan
+    if (rec_offset < 0 && !is_sorted) {
+        ret_val = scan_unsorted_dir(iso, &block_buf, &arena, &range,
+                                        name, length, &rec_offset);
+        if (ret_val != IMN_OK) {
+            goto exit_scan;
+        }
+    }
+
+    if (rec_offset < 0) {
+        ret_val = IMN_PATH_ERR;
+        goto exit_scan;
+    }
+
+    range.start = rec_offset;
+    ret_val = search_record(&cur_record, iso, &block_buf, &arena,
+                                NULL, &range);
+    if (ret_val != IMN_OK) {
+        goto exit_scan;
+    }
+
+    ret_val = clone_record(record, &cur_record, NULL);
+
+    exit_scan:
+        free_arena(&arena);
+        free_block_buf(&block_buf);
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_lookup(imn_iso_t *iso, char *path, imn_record_t *record) {
+
+    imn_error_t ret_val;
+    imn_vol_desc_t *desc;
+    imn_pt_entry_t *pt_entry;
+
+    char *seg_start, *seg_end, *next_seg;
+    size_t seg_len;
+    uint32_t dir_num, pt_idx;
+
+    if (iso == NULL || path == NULL || record == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    desc = iso->desc;
+    if (desc->pt_num == 0) {
+        ret_val = IMN_STD_ERR;
+        goto exit_normal;
+    }
+
+    seg_start = path;
+    while (*seg_start == '/') {
+        seg_start++;
+    }
+
+    if (*seg_start == '\0') {
+        ret_val = clone_record(record, desc->root_dir, NULL);
+        goto exit_normal;
+    }
+
+    // Path table numbers directories from 1, root first
+    dir_num = 1;
+    pt_idx = 0;
+
+    while (true) {
+
+        seg_end = strchr(seg_start, '/');
+        if (seg_end == NULL) {
+            seg_end = seg_start + strlen(seg_start);
+        }
+        seg_len = seg_end - seg_start;
+
+        next_seg = seg_end;
+        while (*next_seg == '/') {
+            next_seg++;
+        }
+
+        // Last component; resolved against its directory's extent
+        if (*next_seg == '\0') {
+            break;
+        }
+
+        // Parent numbers never decrease, so children follow their parent
+        for (pt_idx++; pt_idx < desc->pt_num; pt_idx++) {
+
+            pt_entry = &desc->pt_list[pt_idx];
+            if (pt_entry->parent > dir_num) {
+                pt_idx = desc->pt_num;
+                break;
+            }
+
+            if (pt_entry->parent == dir_num &&
+                    pt_entry->id_length == seg_len &&
+                    memcmp(desc->pt_names + pt_entry->name_offset,
+                            seg_start, seg_len) == 0) {
+                break;
+            }
+        }
+
+        if (pt_idx >= desc->pt_num) {
+            ret_val = IMN_PATH_ERR;
+            goto exit_normal;
+        }
+
+        dir_num = pt_idx + 1;
+        seg_start = next_seg;
+    }
+
+    ret_val = find_in_dir(iso, desc->pt_list[dir_num - 1].lba,
+                            seg_start, seg_len, record);
+
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_get_extents(imn_record_t *dir_record,
+        imn_user_extent_t *list, int list_size) {
+
+    imn_error_t ret_val;
+    imn_extent_t *cur_extent;
+    int list_index;
+    off_t rel_offset;
+
+    if (list == NULL || dir_record == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    if (list_size < dir_record->extent_num) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    list_index = 0;
+    rel_offset = 0;
+    cur_extent = dir_record->extent_list;
+    while (cur_extent != NULL) {
+        list[list_index].lba_offset = cur_extent->lba_offset;
+        list[list_index].data_length = cur_extent->data_length;
+        list[list_index].file_name = dir_record->record_id;
+        list[list_index].rel_offset = rel_offset;
+
+        rel_offset += list[list_index].data_length;
+        cur_extent = cur_extent->link;
+        list_index++;
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_get_path(imn_record_t *record, char *buffer, int buffer_size) {
+
+    imn_error_t ret_val;
+    size_t path_len;
+
+    if (buffer == NULL || record == NULL || buffer_size <= 0) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    if (record->parent_dir == NULL) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+
+    ret_val = build_path(record, buffer, buffer_size, &path_len);
+
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t write_all(int out_fd, uint8_t *src, size_t length) {
+
+    imn_error_t ret_val;
+    ssize_t write_ret;
+
+    while (length > 0) {
+
+        write_ret = write(out_fd, src, length);
+        if (write_ret == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (write_ret <= 0) {
+            ret_val = IMN_ACCESS_ERR;
+            goto exit_normal;
+        }
+
+        src += write_ret;
+        length -= write_ret;
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+uint32_t hash_child(uint32_t parent, char *name, size_t length) {
+
+    uint32_t hash;
+    size_t pos;
+
+    // FNV-1a over the parent index followed by the identifier
+    hash = 2166136261u ^ parent;
+    hash *= 16777619u;
+
+    for (pos = 0; pos < length; pos++) {
+        hash ^= (uint8_t) name[pos];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static
+bool index_find_child(imn_index_t *index, uint32_t parent,
+        char *name, size_t length, uint32_t *child) {
+
+    imn_index_entry_t *entry;
+    size_t slot, mask;
+    uint32_t cur_idx;
+
+    mask = index->hash_size - 1;
+    slot = hash_child(parent, name, length) & mask;
+
+    // Slots hold entry index + 1; zero marks the end of a probe run
+    while (index->hash_slots[slot] != 0) {
+
+        cur_idx = index->hash_slots[slot] - 1;
+        entry = &index->entries[cur_idx];
+
+        if (entry->parent == parent && entry->id_length == length &&
+                memcmp(index->name_pool + entry->name_offset,
+                        name, length) == 0) {
+            *child = cur_idx;
+            return true;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return false;
+}
+
+static
+imn_error_t index_build_hash(imn_index_t *index) {
+
+    imn_error_t ret_val;
+    imn_index_entry_t *entry;
+    size_t hash_size, slot;
+    uint32_t cur_idx;
+
+    hash_size = 64;
+    while (hash_size < index->entry_num * 2) {
+        hash_size *= 2;
+    }
+
+    index->hash_slots = calloc(hash_size, sizeof(*index->hash_slots));
+    if (index->hash_slots == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+    index->hash_size = hash_size;
+
+    for (cur_idx = 0; cur_idx < index->entry_num; cur_idx++) {
+
+        if (cur_idx == INDEX_ROOT) {
+            continue;
+        }
+
+        entry = &index->entries[cur_idx];
+        slot = hash_child(entry->parent,
+                            index->name_pool + entry->name_offset,
+                            entry->id_length) & (hash_size - 1);
+
+        while (index->hash_slots[slot] != 0) {
+            slot = (slot + 1) & (hash_size - 1);
+        }
+        index->hash_slots[slot] = cur_idx + 1;
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t index_add_entry(imn_index_t *index, uint32_t parent,
+        imn_record_t *record) {
+
+    imn_error_t ret_val;
+    imn_index_entry_t *entry;
+    imn_extent_t *cur_extent;
+
+    ret_val = reserve_items((void **) &index->entries, &index->entry_cap,
+                                index->entry_num + 1, sizeof(*entry));
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    ret_val = reserve_items((void **) &index->extents, &index->extent_cap,
+                                index->extent_num + record->extent_num,
+                                sizeof(*index->extents));
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    ret_val = reserve_items((void **) &index->name_pool, &index->pool_cap,
+                                index->pool_size + record->id_length + 1, 1);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    entry = &index->entries[index->entry_num];
+
+    // Padding goes to disk with the sidecar; never leave heap bytes in it
+    memset(entry, 0, sizeof(*entry));
+
+    entry->parent = parent;
+    entry->first_child = 0;
+    entry->child_num = 0;
+
+    entry->is_hidden = record->is_hidden;
+    entry->is_dir = record->is_dir;
+    entry->total_size = record->total_size;
+
+    entry->name_offset = index->pool_size;
+    entry->id_length = record->id_length;
+
+    memcpy(index->name_pool + index->pool_size, record->record_id,
+                record->id_length);
+    index->name_pool[index->pool_size + record->id_length] = '\0';
+    index->pool_size += record->id_length + 1;
+
+    entry->first_extent = index->extent_num;
+    entry->extent_num = 0;
+
+    cur_extent = record->extent_list;
+    while (cur_extent != NULL) {
+        index->extents[index->extent_num].lba_offset = cur_extent->lba_offset;
+        index->extents[index->extent_num].data_length =
+                                                cur_extent->data_length;
+        index->extent_num++;
+        entry->extent_num++;
+        cur_extent = cur_extent->link;
+    }
+
+    index->entry_num++;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t index_scan_dir(imn_iso_t *iso, imn_index_t *index,
+        uint32_t dir_idx, imn_block_buf_t *buf, imn_arena_t *arena) {
+
+    imn_error_t ret_val;
+
+    imn_index_extent_t dir_extent;
+    imn_record_t cur_record;
+    imn_arena_mark_t scope_mark;
+    imn_range_t range;
+
+    uint32_t ext_idx, first_child;
+    uint16_t block_size;
+
+    block_size = iso->desc->block_size;
+    first_child = index->entry_num;
+    scope_mark = arena_mark(arena);
+
+    // Entries array may move while appending; always index, never point
+    for (ext_idx = 0; ext_idx < index->entries[dir_idx].extent_num;
+            ext_idx++) {
+
+        dir_extent = index->extents[index->entries[dir_idx].first_extent +
+                                        ext_idx];
+
+        range.start = (off_t) dir_extent.lba_offset * block_size;
+        range.end = range.start + dir_extent.data_length;
+
+        ret_val = set_read_window(iso, buf, dir_extent.lba_offset,
+                    (dir_extent.data_length + block_size - 1) / block_size);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        while (range.start < range.end) {
+
+            ret_val = search_record(&cur_record, iso, buf, arena,
+                                        NULL, &range);
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
+
+            if (cur_record.extent_num == 0) break;
+            range.start = cur_record.extent_span.end;
+
+            // Skip self and parent records; tree links replace them
+            if (!cur_record.is_dir ||
+                    (cur_record.record_id[0] != '\0' &&
+                     cur_record.record_id[0] != '\1')) {
+
+                ret_val = index_add_entry(index, dir_idx, &cur_record);
+                if (ret_val != IMN_OK) {
+                    goto exit_normal;
+                }
+            }
+
+            arena_rewind(arena, scope_mark);
+        }
+    }
+
+    index->entries[dir_idx].first_child = first_child;
+    index->entries[dir_idx].child_num = index->entry_num - first_child;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        arena_rewind(arena, scope_mark);
+        return ret_val;
+}
+
+imn_error_t imn_build_index(imn_iso_t *iso, imn_index_t *index) {
+
+    imn_error_t ret_val;
+    imn_block_buf_t block_buf;
+    imn_arena_t arena;
+    uint32_t dir_idx;
+
+    if (iso == NULL || index == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    memset(index, 0, sizeof(*index));
+    index->desc_idx = iso->desc->desc_idx;
+
+    ret_val = index_add_entry(index, INDEX_ROOT, iso->desc->root_dir);
+    if (ret_val != IMN_OK) {
+        goto exit_index;
+    }
+
+    ret_val = init_block_buf(iso, &block_buf);
+    if (ret_val != IMN_OK) {
+        goto exit_index;
+    }
+    init_arena(&arena, iso->stats);
+
+    // Breadth-first, so every directory's children end up contiguous
+    for (dir_idx = 0; dir_idx < index->entry_num; dir_idx++) {
+
+        if (!index->entries[dir_idx].is_dir) {
+            continue;
+        }
+
+        ret_val = index_scan_dir(iso, index, dir_idx, &block_buf, &arena);
+        if (ret_val != IMN_OK) {
+            goto exit_scan;
+        }
+    }
+
+    ret_val = index_build_hash(index);
+    if (ret_val != IMN_OK) {
+        goto exit_scan;
+    }
+
+    free_arena(&arena);
+    free_block_buf(&block_buf);
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_scan:
+        free_arena(&arena);
+        free_block_buf(&block_buf);
+    exit_index:
+        imn_free_index(index);
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_index_lookup(imn_index_t *index, char *path, uint32_t *entry) {
+
+    imn_error_t ret_val;
+    uint32_t cur_idx;
+    size_t seg_len;
+    char *seg_end;
+
+    if (index == NULL || index->entries == NULL ||
+            path == NULL || entry == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    cur_idx = INDEX_ROOT;
+    while (*path != '\0') {
+
+        if (*path == '/') {
+            path++;
+            continue;
+        }
+
+        seg_end = strchr(path, '/');
+        if (seg_end == NULL) {
+            seg_end = path + strlen(path);
+        }
+        seg_len = seg_end - path;
+
+        if (!index->entries[cur_idx].is_dir) {
+            ret_val = IMN_DIR_ERR;
+            goto exit_normal;
+        }
+
+        if (seg_len == 2 && path[0] == '.' && path[1] == '.') {
+            cur_idx = index->entries[cur_idx].parent;
+
+        } else if (seg_len != 1 || path[0] != '.') {
+
+            if (!index_find_child(index, cur_idx, path, seg_len, &cur_idx)) {
+                ret_val = IMN_PATH_ERR;
+                goto exit_normal;
+            }
+        }
+
+        path = seg_end;
+    }
+
+    *entry = cur_idx;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t fill_index_record(imn_index_t *index, uint32_t entry_idx,
+        imn_record_t *record, imn_record_t *parent, imn_arena_t *arena) {
+
+    imn_error_t ret_val;
+    imn_index_entry_t *entry;
+    imn_extent_t *cur_extent, **link;
+    uint32_t ext_idx;
+
+    entry = &index->entries[entry_idx];
+
+    record->parent_dir = parent;
+    record->total_size = entry->total_size;
+
+    record->is_hidden = entry->is_hidden;
+    record->is_dir = entry->is_dir;
+
+    // Raw record location is not kept by the index
+    record->extent_span.start = 0;
+    record->extent_span.end = 0;
+
+    record->extent_num = entry->extent_num;
+    record->extent_list = NULL;
+
+    link = &record->extent_list;
+    for (ext_idx = 0; ext_idx < entry->extent_num; ext_idx++) {
+
+        cur_extent = arena_alloc(arena, sizeof(*cur_extent));
+        if (cur_extent == NULL) {
+            ret_val = IMN_ALLOC_ERR;
+            goto exit_normal;
+        }
+
+        cur_extent->lba_offset =
+                index->extents[entry->first_extent + ext_idx].lba_offset;
+        cur_extent->data_length =
+                index->extents[entry->first_extent + ext_idx].data_length;
+        cur_extent->link = NULL;
+
+        *link = cur_extent;
+        link = &cur_extent->link;
+    }
+
+    record->id_length = entry->id_length;
+    record->record_id = index->name_pool + entry->name_offset;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t index_traverse_scope(imn_index_t *index, uint32_t dir_idx,
+        imn_record_t *dir_record, imn_callback_t *callback, bool recursive,
+        imn_arena_t *arena) {
+
+    imn_error_t ret_val;
+    imn_index_entry_t *dir_entry;
+    imn_record_t cur_record;
+    imn_arena_mark_t scope_mark;
+
+    uint32_t child_idx;
+    int call_ret;
+
+    dir_entry = &index->entries[dir_idx];
+    scope_mark = arena_mark(arena);
+
+    for (child_idx = dir_entry->first_child;
+            child_idx < dir_entry->first_child + dir_entry->child_num;
+            child_idx++) {
+
+        ret_val = fill_index_record(index, child_idx, &cur_record,
+                                        dir_record, arena);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        if (!cur_record.is_dir) {
+            call_ret = callback->fn(&cur_record, callback->args);
+            if (call_ret < 0) {
+                ret_val = IMN_CALLBACK_ERR;
+                goto exit_normal;
+            }
+
+        } else if (recursive) {
+
+            ret_val = index_traverse_scope(index, child_idx, &cur_record,
+                                            callback, recursive, arena);
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
+        }
+
+        arena_rewind(arena, scope_mark);
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        arena_rewind(arena, scope_mark);
+        return ret_val;
+}
+
+imn_error_t imn_index_traverse(imn_index_t *index, uint32_t dir_entry,
+        imn_callback_t *callback, bool recursive) {
+
+    imn_error_t ret_val;
+    imn_record_t *chain;
+    imn_arena_t arena;
+
+    uint32_t cur_idx, depth, level;
+
+    if (index == NULL || index->entries == NULL || callback == NULL ||
+            dir_entry >= index->entry_num) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    if (!index->entries[dir_entry].is_dir) {
+        ret_val = IMN_DIR_ERR;
+        goto exit_normal;
+    }
+
+    init_arena(&arena, NULL);
+
+    // Rebuild the ancestor chain so imn_get_path sees full paths
+    depth = 1;
+    for (cur_idx = dir_entry; cur_idx != INDEX_ROOT;
+            cur_idx = index->entries[cur_idx].parent) {
+        depth++;
+    }
+
+    chain = arena_alloc(&arena, depth * sizeof(*chain));
+    if (chain == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_arena;
+    }
+
+    cur_idx = dir_entry;
+    for (level = depth; level > 0; level--) {
+
+        ret_val = fill_index_record(index, cur_idx, &chain[level - 1],
+                        (level > 1) ? &chain[level - 2] : NULL, &arena);
+        if (ret_val != IMN_OK) {
+            goto exit_arena;
+        }
+        cur_idx = index->entries[cur_idx].parent;
+    }
+
+    ret_val = index_traverse_scope(index, dir_entry, &chain[depth - 1],
+                                    callback, recursive, &arena);
+
+    exit_arena:
+        free_arena(&arena);
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_index_extents(imn_index_t *index, uint32_t entry,
+        imn_user_extent_t *list, int list_size) {
+
+    imn_error_t ret_val;
+    imn_index_entry_t *cur_entry;
+    uint32_t ext_idx;
+    off_t rel_offset;
+
+    if (index == NULL || list == NULL || entry >= index->entry_num) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    cur_entry = &index->entries[entry];
+    if (list_size < 0 || (uint32_t) list_size < cur_entry->extent_num) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    rel_offset = 0;
+    for (ext_idx = 0; ext_idx < cur_entry->extent_num; ext_idx++) {
+
+        list[ext_idx].lba_offset =
+                index->extents[cur_entry->first_extent + ext_idx].lba_offset;
+        list[ext_idx].data_length =
+                index->extents[cur_entry->first_extent + ext_idx].data_length;
+        list[ext_idx].file_name = index->name_pool + cur_entry->name_offset;
+        list[ext_idx].rel_offset = rel_offset;
+
+        rel_offset += list[ext_idx].data_length;
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+void imn_free_index(imn_index_t *index) {
+
+    if (index == NULL) {
+        return;
+    }
+
+    // Sidecar-backed arrays belong to the mapping
+    if (index->index_map != NULL) {
+        munmap(index->index_map, index->map_size);
+
+    } else {
+        free(index->entries);
+        free(index->extents);
+        free(index->name_pool);
+        free(index->hash_slots);
+    }
+
+    memset(index, 0, sizeof(*index));
+}
+
+static
+uint64_t align_section(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+static
+uint64_t index_checksum(imn_index_t *index) {
+
+    uint64_t hash;
+
+    // A torn write leaves zeroed sections that pass every bounds check
+    hash = hash_bytes((uint8_t *) index->entries,
+                        index->entry_num * sizeof(*index->entries));
+    hash = hash_chain(hash, (uint8_t *) index->extents,
+                        index->extent_num * sizeof(*index->extents));
+    hash = hash_chain(hash, (uint8_t *) index->name_pool, index->pool_size);
+    hash = hash_chain(hash, (uint8_t *) index->hash_slots,
+                        index->hash_size * sizeof(*index->hash_slots));
+
+    return hash;
+}
+
+static
+imn_error_t write_section(int out_fd, void *data, size_t length,
+        uint64_t offset, uint64_t *file_pos) {
+
+    imn_error_t ret_val;
+    uint8_t padding[8];
+
+    memset(padding, 0, sizeof(padding));
+
+    ret_val = write_all(out_fd, padding, offset - *file_pos);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    ret_val = write_all(out_fd, data, length);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+    *file_pos = offset + length;
+
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_save_index(imn_iso_t *iso, imn_index_t *index,
+        char *index_path) {
+
+    imn_error_t ret_val;
+    imn_index_header_t header;
+
+    uint64_t file_pos;
+    char *tmp_path;
+    size_t path_len;
+    int out_fd;
+
+    if (iso == NULL || index == NULL || index_path == NULL ||
+            index->entry_num == 0) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.endian_tag = INDEX_ENDIAN_TAG;
+
+    header.image_size = iso->image_size;
+    header.image_mtime = iso->image_mtime;
+    header.desc_hash = iso->desc_hash;
+    header.desc_idx = index->desc_idx;
+
+    header.entry_num = index->entry_num;
+    header.extent_num = index->extent_num;
+    header.pool_size = index->pool_size;
+    header.hash_size = index->hash_size;
+    header.checksum = index_checksum(index);
+
+    header.entries_offset = align_section(sizeof(header));
+    header.extents_offset = align_section(header.entries_offset +
+                                index->entry_num * sizeof(*index->entries));
+    header.pool_offset = align_section(header.extents_offset +
+                                index->extent_num * sizeof(*index->extents));
+    header.hash_offset = align_section(header.pool_offset +
+                                index->pool_size);
+
+    // Written beside the target and renamed, so readers never see half
+    path_len = strlen(index_path);
+    tmp_path = malloc(path_len + sizeof(".tmp"));
+    if (tmp_path == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+    memcpy(tmp_path, index_path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", sizeof(".tmp"));
+
+    out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd == -1) {
+        ret_val = IMN_PATH_ERR;
+        goto exit_path;
+    }
+
+    file_pos = 0;
+    ret_val = write_section(out_fd, &header, sizeof(header), 0, &file_pos);
+    if (ret_val == IMN_OK) {
+        ret_val = write_section(out_fd, index->entries,
+                    index->entry_num * sizeof(*index->entries),
+                    header.entries_offset, &file_pos);
+    }
+    if (ret_val == IMN_OK) {
+        ret_val = write_section(out_fd, index->extents,
+                    index->extent_num * sizeof(*index->extents),
+                    header.extents_offset, &file_pos);
+    }
+    if (ret_val == IMN_OK) {
+        ret_val = write_section(out_fd, index->name_pool, index->pool_size,
+                    header.pool_offset, &file_pos);
+    }
+    if (ret_val == IMN_OK) {
+        ret_val = write_section(out_fd, index->hash_slots,
+                    index->hash_size * sizeof(*index->hash_slots),
+                    header.hash_offset, &file_pos);
+    }
+    if (ret_val != IMN_OK) {
+        goto exit_file;
+    }
+
+    // Data must be durable before the rename makes it the sidecar
+    if (fsync(out_fd) == -1) {
+        ret_val = IMN_ACCESS_ERR;
+        goto exit_file;
+    }
+
+    if (close(out_fd) == -1) {
+        ret_val = IMN_ACCESS_ERR;
+        goto exit_unlink;
+    }
+
+    if (rename(tmp_path, index_path) == -1) {
+        ret_val = IMN_ACCESS_ERR;
+        goto exit_unlink;
+    }
+
+    ret_val = IMN_OK;
+    goto exit_path;
+
+    exit_file:
+        close(out_fd);
+    exit_unlink:
+        unlink(tmp_path);
+    exit_path:
+        free(tmp_path);
+    exit_normal:
+        return ret_val;
+}
+
+static
+bool section_fits(size_t map_size, uint64_t offset, uint64_t item_num,
+        size_t item_size) {
+
+    if (offset % 8 != 0 || offset > map_size) {
+        return false;
+    }
+
+    return item_num <= (map_size - offset) / item_size;
+}
+
+static
+imn_error_t check_index(imn_index_t *index) {
+
+    imn_index_entry_t *entry;
+    size_t entry_idx, empty_num;
+
+    if (index->entry_num == 0 || index->hash_size == 0 ||
+            (index->hash_size & (index->hash_size - 1)) != 0 ||
+            index->entry_num > UINT32_MAX) {
+        return IMN_STD_ERR;
+    }
+
+    // Every reference must stay inside the mapping before anyone walks it
+    for (entry_idx = 0; entry_idx < index->entry_num; entry_idx++) {
+
+        entry = &index->entries[entry_idx];
+        if (entry->parent >= index->entry_num ||
+                (uint64_t) entry->first_child + entry->child_num >
+                    index->entry_num ||
+                (uint64_t) entry->first_extent + entry->extent_num >
+                    index->extent_num ||
+                (uint64_t) entry->name_offset + entry->id_length >=
+                    index->pool_size) {
+            return IMN_STD_ERR;
+        }
+
+        // Names are handed out as C strings
+        if (index->name_pool[entry->name_offset + entry->id_length] != '\0') {
+            return IMN_STD_ERR;
+        }
+
+        if (entry->is_hidden > 1 || entry->is_dir > 1) {
+            return IMN_STD_ERR;
+        }
+
+        // Entries are written breadth-first: parents come before their
+        // children, so upward walks and recursion always terminate
+        if ((entry_idx == INDEX_ROOT) ? entry->parent != INDEX_ROOT :
+                entry->parent >= entry_idx) {
+            return IMN_STD_ERR;
+        }
+
+        if (entry->child_num > 0 && entry->first_child <= entry_idx) {
+            return IMN_STD_ERR;
+        }
+    }
+
+    // Probe runs end on an empty slot; a full table would never stop
+    empty_num = 0;
+    for (entry_idx = 0; entry_idx < index->hash_size; entry_idx++) {
+        if (index->hash_slots[entry_idx] > index->entry_num) {
+            return IMN_STD_ERR;
+        }
+        empty_num += (index->hash_slots[entry_idx] == 0);
+    }
+
+    if (empty_num == 0) {
+        return IMN_STD_ERR;
+    }
+
+    return IMN_OK;
+}
+
+imn_error_t imn_load_index(imn_iso_t *iso, imn_index_t *index,
+        char *index_path) {
+
+    imn_error_t ret_val;
+    imn_index_header_t *header;
+    struct stat index_stat;
+
+    uint8_t *index_map;
+    size_t map_size;
+    int index_fd;
+
+    if (iso == NULL || index == NULL || index_path == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    memset(index, 0, sizeof(*index));
+
+    index_fd = open(index_path, O_RDONLY);
+    if (index_fd == -1) {
+        ret_val = IMN_PATH_ERR;
+        goto exit_normal;
+    }
+
+    if (fstat(index_fd, &index_stat) == -1 ||
+            (size_t) index_stat.st_size < sizeof(*header)) {
+        ret_val = IMN_STD_ERR;
+        goto exit_fd;
+    }
+    map_size = index_stat.st_size;
+
+    index_map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, index_fd, 0);
+    if (index_map == MAP_FAILED) {
+        ret_val = IMN_ACCESS_ERR;
+        goto exit_fd;
+    }
+    header = (imn_index_header_t *) index_map;
+
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != INDEX_VERSION ||
+            header->endian_tag != INDEX_ENDIAN_TAG) {
+        ret_val = IMN_STD_ERR;
+        goto exit_map;
+    }
+
+    if (header->image_size != iso->image_size ||
+            header->image_mtime != iso->image_mtime ||
+            header->desc_hash != iso->desc_hash ||
+            header->desc_idx != iso->desc->desc_idx) {
+        ret_val = IMN_STALE_ERR;
+        goto exit_map;
+    }
+
+    if (!section_fits(map_size, header->entries_offset,
+                header->entry_num, sizeof(imn_index_entry_t)) ||
+            !section_fits(map_size, header->extents_offset,
+                header->extent_num, sizeof(imn_index_extent_t)) ||
+            !section_fits(map_size, header->pool_offset,
+                header->pool_size, sizeof(char)) ||
+            !section_fits(map_size, header->hash_offset,
+                header->hash_size, sizeof(uint32_t))) {
+        ret_val = IMN_STD_ERR;
+        goto exit_map;
+    }
+
+    // No copies: every array is a view into the mapping
+    index->entries = (imn_index_entry_t *) (index_map +
+                        header->entries_offset);
+    index->entry_num = header->entry_num;
+    index->extents = (imn_index_extent_t *) (index_map +
+                        header->extents_offset);
+    index->extent_num = header->extent_num;
+    index->name_pool = (char *) (index_map + header->pool_offset);
+    index->pool_size = header->pool_size;
+    index->hash_slots = (uint32_t *) (index_map + header->hash_offset);
+    index->hash_size = header->hash_size;
+    index->desc_idx = header->desc_idx;
+
+    if (index_checksum(index) != header->checksum) {
+        ret_val = IMN_STD_ERR;
+        goto exit_map;
+    }
+
+    ret_val = check_index(index);
+    if (ret_val != IMN_OK) {
+        goto exit_map;
+    }
+
+    index->index_map = index_map;
+    index->map_size = map_size;
+    close(index_fd);
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_map:
+        munmap(index_map, map_size);
+        memset(index, 0, sizeof(*index));
+    exit_fd:
+        close(index_fd);
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_open_index(imn_iso_t *iso, imn_index_t *index,
+        char *index_path) {
+
+    imn_error_t ret_val;
+
+    ret_val = imn_load_index(iso, index, index_path);
+    if (ret_val == IMN_OK || ret_val == IMN_ARGS_ERR) {
+        goto exit_normal;
+    }
+
+    ret_val = imn_build_index(iso, index);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    // Sidecar is only a cache; a read-only directory is not an error
+    imn_save_index(iso, index, index_path);
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+uint32_t find_span(imn_file_t *file, off_t offset) {
+
+    uint32_t span_lo, span_hi, span_mid;
+
+    // Last span starting at or before the offset
+    span_lo = 0;
+    span_hi = file->span_num;
+
+    while (span_hi - span_lo > 1) {
+        span_mid = span_lo + (span_hi - span_lo) / 2;
+
+        if (file->span_list[span_mid].rel_offset <= offset) {
+            span_lo = span_mid;
+        } else {
+            span_hi = span_mid;
+        }
+    }
+
+    return span_lo;
+}
+
+static
+imn_error_t read_raw(imn_file_t *file, uint8_t *buffer, size_t length,
+        off_t offset, size_t *read_len) {
+
+    imn_error_t ret_val;
+    imn_file_span_t *cur_span;
+
+    uint32_t span_idx;
+    size_t chunk_len, done_len;
+    off_t span_pos;
+
+    *read_len = 0;
+    if (offset >= file->raw_size || length == 0) {
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    if ((off_t) length > file->raw_size - offset) {
+        length = file->raw_size - offset;
+    }
+
+    done_len = 0;
+    span_idx = find_span(file, offset);
+
+    // Each span goes straight from the image into the caller's buffer
+    while (done_len < length) {
+
+        cur_span = &file->span_list[span_idx];
+        span_pos = offset + done_len - cur_span->rel_offset;
+
+        chunk_len = length - done_len;
+        if ((off_t) chunk_len > cur_span->length - span_pos) {
+            chunk_len = cur_span->length - span_pos;
+        }
+
+        ret_val = read_bytes(file->iso, cur_span->disk_offset + span_pos,
+                                chunk_len, buffer + done_len);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        done_len += chunk_len;
+        span_idx++;
+    }
+
+    *read_len = done_len;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+void ziso_free(imn_ziso_t *ziso) {
+
+    if (ziso == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&ziso->lock);
+    free(ziso->block_ptrs);
+    free(ziso->comp_buf);
+    free(ziso->cache_data);
+    free(ziso);
+}
+
+// Rock Ridge is only consulted once the header has the magic, so plain
+// files never pay for SUSP parsing
+static
+imn_error_t ziso_check_zf(imn_file_t *file, imn_record_t *record,
+        uint8_t *header, bool *is_ziso) {
+
+    imn_error_t ret_val;
+    imn_rr_attr_t rr_attr;
+
+    *is_ziso = true;
+    if (!file->iso->desc->has_susp) {
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    // Index records have no System Use area; they read as stored
+    ret_val = imn_get_rr(file->iso, record, &rr_attr);
+    if (ret_val == IMN_ARGS_ERR) {
+        *is_ziso = false;
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    // Without ZF the magic is just file content; with it, ZF and the
+    // header must describe the same stream
+    if (!rr_attr.has_zf) {
+        *is_ziso = false;
+    } else if (rr_attr.zf_size != LE_int32(header + 8) ||
+                rr_attr.zf_block_log2 != header[13]) {
+        ret_val = IMN_STD_ERR;
+    }
+    imn_free_rr(&rr_attr);
+
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t ziso_open(imn_file_t *file, imn_record_t *record) {
+
+    imn_error_t ret_val;
+    imn_ziso_t *ziso;
+    uint8_t header[ZISO_HEADER_SIZE];
+    uint8_t *table;
+
+    uint32_t block_idx, comp_len, file_size;
+    size_t table_len, read_len;
+    uint8_t block_log2;
+    bool is_ziso;
+
+    ziso = NULL;
+    table = NULL;
+
+    // Anything without the zisofs magic is read as-is
+    if (file->raw_size < ZISO_HEADER_SIZE) {
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    ret_val = read_raw(file, header, ZISO_HEADER_SIZE, 0, &read_len);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    block_log2 = header[13];
+    if (memcmp(header, ZISO_MAGIC, 8) != 0 ||
+            header[12] != ZISO_HEADER_SIZE / 4 ||
+            block_log2 < ZISO_LOG2_MIN || block_log2 > ZISO_LOG2_MAX) {
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    ret_val = ziso_check_zf(file, record, header, &is_ziso);
+    if (ret_val != IMN_OK || !is_ziso) {
+        goto exit_normal;
+    }
+
+    ziso = calloc(1, sizeof(*ziso));
+    if (ziso == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    file_size = LE_int32(header + 8);
+    ziso->block_size = (uint32_t) 1 << block_log2;
+    ziso->block_num = (file_size + ziso->block_size - 1) >> block_log2;
+
+    // Table of block_num + 1 offsets follows the header
+    table_len = ((size_t) ziso->block_num + 1) * 4;
+    if ((off_t) (ZISO_HEADER_SIZE + table_len) > file->raw_size) {
+        ret_val = IMN_STD_ERR;
+        goto exit_ziso;
+    }
+
+    table = malloc(table_len);
+    ziso->block_ptrs = malloc(table_len);
+    ziso->cache_data = malloc((size_t) ZISO_CACHE_NUM * ziso->block_size);
+    if (table == NULL || ziso->block_ptrs == NULL ||
+            ziso->cache_data == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_ziso;
+    }
+    STAT_ADD(file->iso->stats, allocs, 4);
+
+    ret_val = read_raw(file, table, table_len, ZISO_HEADER_SIZE, &read_len);
+    if (ret_val != IMN_OK) {
+        goto exit_ziso;
+    }
+
+    for (block_idx = 0; block_idx <= ziso->block_num; block_idx++) {
+
+        ziso->block_ptrs[block_idx] = LE_int32(table + block_idx * 4);
+
+        if (ziso->block_ptrs[block_idx] > file->raw_size ||
+                (block_idx > 0 && ziso->block_ptrs[block_idx] <
+                                    ziso->block_ptrs[block_idx - 1])) {
+            ret_val = IMN_STD_ERR;
+            goto exit_ziso;
+        }
+
+        // Input buffer fits the largest compressed block
+        comp_len = block_idx ? ziso->block_ptrs[block_idx] -
+                                ziso->block_ptrs[block_idx - 1] : 0;
+        if (comp_len > ziso->comp_cap) {
+            ziso->comp_cap = comp_len;
+        }
+    }
+
+    ziso->comp_buf = malloc(ziso->comp_cap ? ziso->comp_cap : 1);
+    if (ziso->comp_buf == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_ziso;
+    }
+
+    for (block_idx = 0; block_idx < ZISO_CACHE_NUM; block_idx++) {
+        ziso->cache_blocks[block_idx] = UINT32_MAX;
+    }
+
+    if (pthread_mutex_init(&ziso->lock, NULL) != 0) {
+        ret_val = IMN_THREAD_ERR;
+        goto exit_ziso;
+    }
+
+    file->ziso = ziso;
+    file->total_size = file_size;
+    free(table);
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_ziso:
+        free(table);
+        free(ziso->block_ptrs);
+        free(ziso->comp_buf);
+        free(ziso->cache_data);
+        free(ziso);
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t ziso_inflate(imn_file_t *file, uint32_t block_idx, uint8_t *dst) {
+
+    imn_error_t ret_val;
+    imn_ziso_t *ziso;
+
+    uLongf out_len;
+    size_t comp_len, read_len, expect_len;
+    uint64_t start;
+
+    ziso = file->ziso;
+    comp_len = ziso->block_ptrs[block_idx + 1] - ziso->block_ptrs[block_idx];
+
+    expect_len = file->total_size - (off_t) block_idx * ziso->block_size;
+    if (expect_len > ziso->block_size) {
+        expect_len = ziso->block_size;
+    }
+
+    // Zero-length blocks stand for runs of zeroes
+    if (comp_len == 0) {
+        memset(dst, 0, expect_len);
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    ret_val = read_raw(file, ziso->comp_buf, comp_len,
+                        ziso->block_ptrs[block_idx], &read_len);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    start = (file->iso->stats != NULL) ? clock_ns() : 0;
+
+    out_len = ziso->block_size;
+    if (read_len != comp_len ||
+            uncompress(dst, &out_len, ziso->comp_buf, comp_len) != Z_OK ||
+            out_len != expect_len) {
+        ret_val = IMN_STD_ERR;
+        goto exit_normal;
+    }
+
+    if (file->iso->stats != NULL) {
+        STAT_ADD(file->iso->stats, decode_ns, clock_ns() - start);
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t ziso_copy(imn_file_t *file, uint32_t block_idx, size_t block_off,
+        size_t length, uint8_t *dst) {
+
+    imn_error_t ret_val;
+    imn_ziso_t *ziso;
+    uint8_t *slot_data;
+    uint32_t slot_idx;
+
+    ziso = file->ziso;
+    pthread_mutex_lock(&ziso->lock);
+
+    for (slot_idx = 0; slot_idx < ZISO_CACHE_NUM; slot_idx++) {
+        if (ziso->cache_blocks[slot_idx] == block_idx) {
+            break;
+        }
+    }
+
+    // Round-robin victim; sequential readers only look one block back
+    if (slot_idx == ZISO_CACHE_NUM) {
+
+        slot_idx = ziso->cache_next;
+        ziso->cache_next = (ziso->cache_next + 1) % ZISO_CACHE_NUM;
+        ziso->cache_blocks[slot_idx] = UINT32_MAX;
+
+        ret_val = ziso_inflate(file, block_idx, ziso->cache_data +
+                                (size_t) slot_idx * ziso->block_size);
+        if (ret_val != IMN_OK) {
+            goto exit_lock;
+        }
+        ziso->cache_blocks[slot_idx] = block_idx;
+    }
+
+    slot_data = ziso->cache_data + (size_t) slot_idx * ziso->block_size;
+    memcpy(dst, slot_data + block_off, length);
+
+    ret_val = IMN_OK;
+    exit_lock:
+        pthread_mutex_unlock(&ziso->lock);
+        return ret_val;
+}
+
+imn_error_t imn_open(imn_iso_t *iso, imn_record_t *record, imn_file_t *file) {
+
+    imn_error_t ret_val;
+    imn_extent_t *cur_extent;
+    imn_file_span_t *cur_span;
+
+    off_t disk_offset, rel_offset;
+    uint16_t block_size;
+
+    if (iso == NULL || record == NULL || file == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    if (record->is_dir) {
+        ret_val = IMN_DIR_ERR;
+        goto exit_normal;
+    }
+
+    file->iso = iso;
+    file->total_size = 0;
+    file->raw_size = 0;
+    file->position = 0;
+    file->span_num = 0;
+    file->ziso = NULL;
+    file->pipeline = NULL;
+    file->chunk_cache = NULL;
+
+    file->span_list = malloc((record->extent_num + 1) *
+                                sizeof(*file->span_list));
+    if (file->span_list == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+    STAT_ADD(iso->stats, allocs, 1);
+
+    block_size = iso->desc->block_size;
+    rel_offset = 0;
+    cur_span = NULL;
+
+    // Coalesce extents that continue on disk into a single read span
+    for (cur_extent = record->extent_list; cur_extent != NULL;
+            cur_extent = cur_extent->link) {
+
+        if (cur_extent->data_length == 0) {
+            continue;
+        }
+
+        disk_offset = (off_t) cur_extent->lba_offset * block_size;
+
+        if (cur_span != NULL &&
+                cur_span->disk_offset + cur_span->length == disk_offset) {
+            cur_span->length += cur_extent->data_length;
+
+        } else {
+
+            cur_span = &file->span_list[file->span_num++];
+            cur_span->disk_offset = disk_offset;
+            cur_span->rel_offset = rel_offset;
+            cur_span->length = cur_extent->data_length;
+        }
+
+        rel_offset += cur_extent->data_length;
+    }
+
+    file->total_size = rel_offset;
+    file->raw_size = rel_offset;
+
+    // zisofs files announce themselves in their first bytes, and on
+    // Rock Ridge volumes in a matching ZF entry too
+    ret_val = ziso_open(file, record);
+    if (ret_val != IMN_OK) {
+        goto exit_spans;
+    }
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_spans:
+        free(file->span_list);
+        file->span_list = NULL;
+        file->span_num = 0;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t read_logical(imn_file_t *file, void *buffer, size_t length,
+        off_t offset, size_t *read_len) {
+
+    imn_error_t ret_val;
+    uint32_t block_idx;
+    size_t block_off, chunk_len, done_len;
+
+    if (file == NULL || buffer == NULL || read_len == NULL || offset < 0) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    if (file->ziso == NULL) {
+        ret_val = read_raw(file, buffer, length, offset, read_len);
+        goto exit_normal;
+    }
+
+    *read_len = 0;
+    if (offset >= file->total_size || length == 0) {
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    if ((off_t) length > file->total_size - offset) {
+        length = file->total_size - offset;
+    }
+
+    // Only the blocks overlapping the request are ever inflated
+    done_len = 0;
+    while (done_len < length) {
+
+        block_idx = (offset + done_len) / file->ziso->block_size;
+        block_off = (offset + done_len) % file->ziso->block_size;
+
+        chunk_len = file->ziso->block_size - block_off;
+        if (chunk_len > length - done_len) {
+            chunk_len = length - done_len;
+        }
+
+        ret_val = ziso_copy(file, block_idx, block_off, chunk_len,
+                            (uint8_t *) buffer + done_len);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        done_len += chunk_len;
+    }
+
+    *read_len = done_len;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t run_stages(imn_pipeline_t *pipeline, uint8_t *data, size_t length,
+        off_t offset) {
+
+    imn_error_t ret_val;
+    imn_transform_t *stage;
+
+    size_t chunk_pos, chunk_len;
+    uint32_t stage_idx;
+
+    // Every stage finishes a chunk before the next chunk starts
+    for (chunk_pos = 0; chunk_pos < length; chunk_pos += chunk_len) {
+
+        chunk_len = length - chunk_pos;
+        if (chunk_len > pipeline->chunk_size) {
+            chunk_len = pipeline->chunk_size;
+        }
+
+        for (stage_idx = 0; stage_idx < pipeline->stage_num; stage_idx++) {
+
+            stage = &pipeline->stage_list[stage_idx];
+            if (stage->fn(data + chunk_pos, chunk_len, offset + chunk_pos,
+                            stage->args) < 0) {
+                ret_val = IMN_CALLBACK_ERR;
+                goto exit_normal;
+            }
+        }
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+void free_chunk_cache(imn_chunk_cache_t *cache) {
+
+    if (cache == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->data);
+    free(cache);
+}
+
+static
+imn_error_t alloc_chunk_cache(imn_file_t *file, size_t chunk_size) {
+
+    imn_error_t ret_val;
+    imn_chunk_cache_t *cache;
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    if (posix_memalign((void **) &cache->data, file->iso->desc->block_size,
+                        chunk_size) != 0) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_cache;
+    }
+    STAT_ADD(file->iso->stats, allocs, 2);
+
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+        ret_val = IMN_THREAD_ERR;
+        goto exit_data;
+    }
+
+    file->chunk_cache = cache;
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_data:
+        free(cache->data);
+    exit_cache:
+        free(cache);
+    exit_normal:
+        return ret_val;
+}
+
+// Copies out of the chunk starting at chunk_start, transforming it into
+// the cache first unless it is already there
+static
+imn_error_t read_cached_chunk(imn_file_t *file, uint8_t *buffer,
+        size_t length, off_t offset, off_t chunk_start, size_t *read_len) {
+
+    imn_error_t ret_val;
+    imn_chunk_cache_t *cache;
+    size_t chunk_len, avail;
+
+    cache = file->chunk_cache;
+    pthread_mutex_lock(&cache->lock);
+
+    if (!cache->is_valid || cache->offset != chunk_start) {
+
+        cache->is_valid = false;
+        ret_val = read_logical(file, cache->data, file->pipeline->chunk_size,
+                                chunk_start, &chunk_len);
+        if (ret_val == IMN_OK) {
+            ret_val = run_stages(file->pipeline, cache->data, chunk_len,
+                                    chunk_start);
+        }
+        if (ret_val != IMN_OK) {
+            goto exit_lock;
+        }
+
+        cache->offset = chunk_start;
+        cache->length = chunk_len;
+        cache->is_valid = true;
+    }
+
+    avail = 0;
+    if (offset - chunk_start < (off_t) cache->length) {
+        avail = cache->length - (offset - chunk_start);
+    }
+    *read_len = (length < avail) ? length : avail;
+    memcpy(buffer, cache->data + (offset - chunk_start), *read_len);
+
+    ret_val = IMN_OK;
+    exit_lock:
+        pthread_mutex_unlock(&cache->lock);
+        return ret_val;
+}
+
+// Stages only ever see whole chunks of the fixed grid (or the tail);
+// whole chunks are transformed in the caller's buffer, the partial ones
+// at either end go through the cache
+static
+imn_error_t read_staged(imn_file_t *file, uint8_t *buffer, size_t length,
+        off_t offset, size_t *read_len) {
+
+    imn_error_t ret_val;
+    size_t chunk_size, piece_len, done;
+    off_t pos, end, chunk_start;
+
+    chunk_size = file->pipeline->chunk_size;
+
+    end = offset;
+    if (offset < file->total_size) {
+        end = ((off_t) length < file->total_size - offset) ?
+                offset + (off_t) length : file->total_size;
+    }
+
+    done = 0;
+    for (pos = offset; pos < end; pos += piece_len) {
+
+        chunk_start = pos - pos % chunk_size;
+
+        // Whole chunks, up to the last boundary (or EOF) before end
+        if (pos == chunk_start && (end == file->total_size ||
+                end - pos >= (off_t) chunk_size)) {
+
+            piece_len = (size_t) (end - pos);
+            if (end != file->total_size) {
+                piece_len -= piece_len % chunk_size;
+            }
+
+            ret_val = read_logical(file, buffer + done, piece_len, pos,
+                                    &piece_len);
+            if (ret_val == IMN_OK) {
+                ret_val = run_stages(file->pipeline, buffer + done,
+                                        piece_len, pos);
+            }
+        } else {
+            ret_val = read_cached_chunk(file, buffer + done, end - pos, pos,
+                                        chunk_start, &piece_len);
+        }
+
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        if (piece_len == 0) {
+            break;
+        }
+        done += piece_len;
+    }
+
+    *read_len = done;
+    ret_val = IMN_OK;
+
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_pread(imn_file_t *file, void *buffer, size_t length,
+        off_t offset, size_t *read_len) {
+
+    imn_error_t ret_val;
+    imn_pipeline_t *pipeline;
+
+    if (file == NULL || buffer == NULL || read_len == NULL || offset < 0) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    pipeline = file->pipeline;
+    if (pipeline == NULL) {
+        ret_val = read_logical(file, buffer, length, offset, read_len);
+        goto exit_normal;
+    }
+
+    ret_val = read_staged(file, buffer, length, offset, read_len);
+
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_read(imn_file_t *file, void *buffer, size_t length,
+        size_t *read_len) {
+
+    imn_error_t ret_val;
+
+    if (file == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    ret_val = imn_pread(file, buffer, length, file->position, read_len);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    file->position += *read_len;
+
+    exit_normal:
+        return ret_val;
+}
+
+void imn_close_file(imn_file_t *file) {
+
+    if (file == NULL) {
+        return;
+    }
+
+    free_chunk_cache(file->chunk_cache);
+    file->chunk_cache = NULL;
+
+    free(file->span_list);
+    file->span_list = NULL;
+    file->span_num = 0;
+
+    ziso_free(file->ziso);
+    file->ziso = NULL;
+    file->pipeline = NULL;
+}
+
+void imn_init_pipeline(imn_pipeline_t *pipeline, size_t chunk_size,
+        bool is_threaded) {
+
+    if (pipeline == NULL) {
+        return;
+    }
+
+    pipeline->stage_num = 0;
+    pipeline->chunk_size = (chunk_size > 0) ? chunk_size : PIPE_CHUNK_SIZE;
+    pipeline->is_threaded = is_threaded;
+}
+
+imn_error_t imn_add_stage(imn_pipeline_t *pipeline, imn_transform_t *stage) {
+
+    imn_error_t ret_val;
+
+    if (pipeline == NULL || stage == NULL || stage->fn == NULL ||
+            pipeline->stage_num >= PIPE_STAGE_MAX) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    pipeline->stage_list[pipeline->stage_num++] = *stage;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_set_pipeline(imn_file_t *file, imn_pipeline_t *pipeline) {
+
+    imn_error_t ret_val;
+
+    if (file == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    // Chunks line up with image blocks so stages get aligned buffers
+    if (pipeline != NULL && (pipeline->chunk_size == 0 ||
+            pipeline->chunk_size % file->iso->desc->block_size != 0)) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    // Chunks transformed by the old stages must not be served again
+    free_chunk_cache(file->chunk_cache);
+    file->chunk_cache = NULL;
+    file->pipeline = NULL;
+
+    if (pipeline != NULL) {
+        ret_val = alloc_chunk_cache(file, pipeline->chunk_size);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+    }
+
+    file->pipeline = pipeline;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+// Stages one read, then hands the result to the caller's output (if any)
+static
+imn_error_t stage_output(imn_stream_t *stream, uint8_t *data, size_t length,
+        off_t offset) {
+
+    imn_error_t ret_val;
+
+    ret_val = run_stages(stream->pipeline, data, length, offset);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    if (stream->output != NULL && stream->output->fn(data, length, offset,
+                                        stream->output->args) < 0) {
+        ret_val = IMN_CALLBACK_ERR;
+        goto exit_normal;
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+void *stage_main(void *args) {
+
+    imn_stream_t *stream;
+    imn_error_t ret_val;
+    uint32_t buf_idx;
+
+    stream = args;
+    pthread_mutex_lock(&stream->lock);
+
+    while (true) {
+
+        while (stream->tail == stream->head && !stream->is_eof &&
+                stream->status == IMN_OK) {
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        }
+
+        // Drained after EOF, or either side failed
+        if (stream->status != IMN_OK || stream->tail == stream->head) {
+            break;
+        }
+
+        buf_idx = stream->tail % PIPE_DEPTH;
+        pthread_mutex_unlock(&stream->lock);
+
+        ret_val = stage_output(stream, stream->buffers[buf_idx],
+                                stream->lengths[buf_idx],
+                                stream->offsets[buf_idx]);
+
+        pthread_mutex_lock(&stream->lock);
+        if (ret_val != IMN_OK) {
+            stream->status = ret_val;
+        } else {
+            stream->tail++;
+        }
+        pthread_cond_broadcast(&stream->cond);
+    }
+
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+static
+imn_error_t stream_threaded(imn_stream_t *stream) {
+
+    imn_error_t ret_val;
+    imn_file_t *file;
+    pthread_t stage_thread;
+
+    uint32_t buf_idx;
+    size_t read_len;
+    off_t offset;
+
+    file = stream->file;
+
+    if (pthread_mutex_init(&stream->lock, NULL) != 0) {
+        ret_val = IMN_THREAD_ERR;
+        goto exit_normal;
+    }
+
+    if (pthread_cond_init(&stream->cond, NULL) != 0) {
+        ret_val = IMN_THREAD_ERR;
+        goto exit_lock;
+    }
+
+    if (pthread_create(&stage_thread, NULL, stage_main, stream) != 0) {
+        ret_val = IMN_THREAD_ERR;
+        goto exit_cond;
+    }
+
+    // Next chunk is read while the stage thread works on earlier ones
+    for (offset = file->position; offset < file->total_size;
+            offset += read_len) {
+
+        pthread_mutex_lock(&stream->lock);
+        while (stream->head - stream->tail == PIPE_DEPTH &&
+                stream->status == IMN_OK) {
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        }
+        ret_val = stream->status;
+        buf_idx = stream->head % PIPE_DEPTH;
+        pthread_mutex_unlock(&stream->lock);
+
+        if (ret_val != IMN_OK) {
+            break;
+        }
+
+        ret_val = read_logical(file, stream->buffers[buf_idx],
+                                stream->pipeline->chunk_size, offset,
+                                &read_len);
+
+        pthread_mutex_lock(&stream->lock);
+        if (ret_val != IMN_OK) {
+            stream->status = ret_val;
+        } else {
+            stream->lengths[buf_idx] = read_len;
+            stream->offsets[buf_idx] = offset;
+            stream->head++;
+        }
+        pthread_cond_broadcast(&stream->cond);
+        pthread_mutex_unlock(&stream->lock);
+
+        if (ret_val != IMN_OK) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    stream->is_eof = true;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+
+    pthread_join(stage_thread, NULL);
+    ret_val = stream->status;
+
+    exit_cond:
+        pthread_cond_destroy(&stream->cond);
+    exit_lock:
+        pthread_mutex_destroy(&stream->lock);
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_stream(imn_file_t *file, imn_transform_t *output) {
+
+    imn_error_t ret_val;
+    imn_stream_t stream;
+    imn_pipeline_t *pipeline;
+
+    uint32_t buf_idx, buf_num;
+    size_t read_len;
+    off_t start;
+
+    if (file == NULL || file->pipeline == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    pipeline = file->pipeline;
+    if (file->position % pipeline->chunk_size != 0) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    memset(&stream, 0, sizeof(stream));
+    stream.file = file;
+    stream.pipeline = pipeline;
+    stream.output = output;
+    stream.status = IMN_OK;
+
+    buf_num = pipeline->is_threaded ? PIPE_DEPTH : 1;
+    for (buf_idx = 0; buf_idx < buf_num; buf_idx++) {
+
+        if (posix_memalign((void **) &stream.buffers[buf_idx],
+                            file->iso->desc->block_size,
+                            pipeline->chunk_size) != 0) {
+            ret_val = IMN_ALLOC_ERR;
+            goto exit_buffers;
+        }
+        STAT_ADD(file->iso->stats, allocs, 1);
+    }
+
+    start = file->position;
+
+    if (pipeline->is_threaded) {
+
+        ret_val = stream_threaded(&stream);
+
+        // Position only covers chunks every stage has finished
+        file->position = start + (off_t) stream.tail * pipeline->chunk_size;
+        if (file->position > file->total_size) {
+            file->position = file->total_size;
+        }
+        goto exit_buffers;
+    }
+
+    while (file->position < file->total_size) {
+
+        ret_val = read_logical(file, stream.buffers[0], pipeline->chunk_size,
+                                file->position, &read_len);
+        if (ret_val != IMN_OK) {
+            goto exit_buffers;
+        }
+
+        ret_val = stage_output(&stream, stream.buffers[0], read_len,
+                                file->position);
+        if (ret_val != IMN_OK) {
+            goto exit_buffers;
+        }
+
+        file->position += read_len;
+    }
+
+    ret_val = IMN_OK;
+    exit_buffers:
+        for (buf_idx = 0; buf_idx < PIPE_DEPTH; buf_idx++) {
+            free(stream.buffers[buf_idx]);
+        }
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_read_batch(imn_iso_t *iso, imn_read_req_t *req_list,
+        size_t req_num) {
+
+    imn_error_t ret_val;
+    size_t req_idx;
+
+    if (iso == NULL || (req_list == NULL && req_num > 0)) {
+        ret_val = IMN_CODE_ERR;
+        goto exit_normal;
+    }
+
+    for (req_idx = 0; req_idx < req_num; req_idx++) {
+        if (req_list[req_idx].buffer == NULL ||
+                req_list[req_idx].offset < 0) {
+            ret_val = IMN_CODE_ERR;
+            goto exit_normal;
+        }
+    }
+
+    ret_val = batch_read(iso, req_list, req_num);
+
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t copy_span(imn_iso_t *iso, off_t in_offset, off_t length,
+        int out_fd) {
+
+    imn_error_t ret_val;
+    uint8_t *src, *chunk;
+    size_t chunk_len;
+    ssize_t copy_ret;
+    int in_fd;
+
+    // Mapping already holds the data; let write() copy it out
+    if (iso->iso_map != NULL) {
+
+        ret_val = map_range(iso, in_offset, length, &src);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        ret_val = write_all(out_fd, src, length);
+        goto exit_normal;
+    }
+
+    in_fd = iso->iso_fd;
+
+#ifdef __linux__
+    // In-kernel copy; falls through when the fd pair is unsupported
+    while (length > 0) {
+
+        copy_ret = copy_file_range(in_fd, &in_offset, out_fd, NULL,
+                                    length, 0);
+        if (copy_ret > 0) {
+            length -= copy_ret;
+            continue;
+        }
+
+        if (copy_ret == -1 && errno == EINTR) {
+            continue;
+        }
+        break;
+    }
+
+    while (length > 0) {
+
+        copy_ret = sendfile(out_fd, in_fd, &in_offset, length);
+        if (copy_ret > 0) {
+            length -= copy_ret;
+            continue;
+        }
+
+        if (copy_ret == -1 && errno == EINTR) {
+            continue;
+        }
+        break;
+    }
+#endif
+
+    if (length == 0) {
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    chunk = malloc(COPY_CHUNK_SIZE);
+    if (chunk == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    while (length > 0) {
+
+        chunk_len = (length < COPY_CHUNK_SIZE) ? length : COPY_CHUNK_SIZE;
+
+        ret_val = read_bytes(iso, in_offset, chunk_len, chunk);
+        if (ret_val != IMN_OK) {
+            goto exit_chunk;
+        }
+
+        ret_val = write_all(out_fd, chunk, chunk_len);
+        if (ret_val != IMN_OK) {
+            goto exit_chunk;
+        }
+
+        in_offset += chunk_len;
+        length -= chunk_len;
+    }
+
+    ret_val = IMN_OK;
+    exit_chunk:
+        free(chunk);
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t inflate_to_fd(imn_file_t *file, int out_fd) {
+
+    imn_error_t ret_val;
+    uint8_t *chunk;
+    size_t read_len;
+    off_t offset;
+
+    chunk = malloc(COPY_CHUNK_SIZE);
+    if (chunk == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    for (offset = 0; offset < file->total_size; offset += read_len) {
+
+        ret_val = imn_pread(file, chunk, COPY_CHUNK_SIZE, offset, &read_len);
+        if (ret_val != IMN_OK) {
+            goto exit_chunk;
+        }
+
+        if (read_len == 0) {
+            ret_val = IMN_STD_ERR;
+            goto exit_chunk;
+        }
+
+        ret_val = write_all(out_fd, chunk, read_len);
+        if (ret_val != IMN_OK) {
+            goto exit_chunk;
+        }
+    }
+
+    ret_val = IMN_OK;
+    exit_chunk:
+        free(chunk);
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t extract_file(imn_iso_t *iso, imn_record_t *record, int out_fd,
+        bool is_raw) {
+
+    imn_error_t ret_val;
+    imn_file_t file;
+    uint32_t span_idx;
+
+    if (iso == NULL || record == NULL || out_fd < 0) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    ret_val = imn_open(iso, record, &file);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    // Compressed files have to pass through userspace to be inflated
+    if (file.ziso != NULL && !is_raw) {
+        ret_val = inflate_to_fd(&file, out_fd);
+        goto exit_file;
+    }
+
+    for (span_idx = 0; span_idx < file.span_num; span_idx++) {
+
+        ret_val = copy_span(iso, file.span_list[span_idx].disk_offset,
+                                file.span_list[span_idx].length, out_fd);
+        if (ret_val != IMN_OK) {
+            goto exit_file;
+        }
+    }
+
+    ret_val = IMN_OK;
+    exit_file:
+        imn_close_file(&file);
+    exit_normal:
+        return ret_val;
+}
+
+imn_error_t imn_extract_to_fd(imn_iso_t *iso, imn_record_t *record,
+        int out_fd) {
+    return extract_file(iso, record, out_fd, false);
+}
+
+imn_error_t imn_extract_raw_to_fd(imn_iso_t *iso, imn_record_t *record,
+        int out_fd) {
+    return extract_file(iso, record, out_fd, true);
+}
+
+static
+void release_task(imn_dir_task_t *task) {
+
+    imn_dir_task_t *parent;
+
+    // Children pin their parent; its record anchors their path chain
+    while (task != NULL && atomic_fetch_sub(&task->ref_count, 1) == 1) {
+        parent = task->parent;
+        free_arena(&task->arena);
+        free(task);
+        task = parent;
+    }
+}
+
+static
+imn_error_t new_task(imn_dir_task_t **task_ret, imn_record_t *record,
+        imn_dir_task_t *parent, unsigned int ref_count) {
+
+    imn_error_t ret_val;
+    imn_dir_task_t *task;
+
+    task = malloc(sizeof(*task));
+    if (task == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    init_arena(&task->arena, NULL);
+    task->entry_list = NULL;
+    task->entry_tail = &task->entry_list;
+    task->is_done = false;
+    task->parent = parent;
+    atomic_init(&task->ref_count, ref_count);
+
+    ret_val = clone_record(&task->record, record, &task->arena);
+    if (ret_val != IMN_OK) {
+        goto exit_task;
+    }
+    task->record.parent_dir = (parent != NULL) ? &parent->record
+                                                 : record->parent_dir;
+
+    if (parent != NULL) {
+        atomic_fetch_add(&parent->ref_count, 1);
+    }
+    *task_ret = task;
+
+    ret_val = IMN_OK;
+    goto exit_normal;
+
+    exit_task:
+        free_arena(&task->arena);
+        free(task);
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t push_task(imn_worker_t *worker, imn_dir_task_t *task) {
+
+    imn_error_t ret_val;
+    imn_pool_t *pool;
+    imn_task_deque_t *deque;
+    imn_dir_task_t **new_list;
+    size_t new_cap, task_idx;
+
+    pool = worker->pool;
+    deque = &pool->deque_list[worker->worker_id];
+
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->tail == deque->cap) {
+
+        // Compact stolen slots before growing the array
+        if (deque->head > 0) {
+            memmove(deque->task_list, deque->task_list + deque->head,
+                        (deque->tail - deque->head) * sizeof(*new_list));
+            deque->tail -= deque->head;
+            deque->head = 0;
+
+        } else {
+
+            new_cap = (deque->cap != 0) ? deque->cap * 2 : 64;
+            new_list = realloc(deque->task_list, new_cap * sizeof(*new_list));
+            if (new_list == NULL) {
+                pthread_mutex_unlock(&deque->lock);
+                ret_val = IMN_ALLOC_ERR;
+                goto exit_normal;
+            }
+            deque->task_list = new_list;
+            deque->cap = new_cap;
+        }
+    }
+
+    // Counted before a thief can see it, or its completion could take
+    // pending to zero and send idle workers home mid-traversal
+    atomic_fetch_add(&pool->pending, 1);
+    atomic_fetch_add(&pool->queued, 1);
+
+    task_idx = deque->tail++;
+    deque->task_list[task_idx] = task;
+    pthread_mutex_unlock(&deque->lock);
+
+    pthread_mutex_lock(&pool->idle_lock);
+    pthread_cond_signal(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_dir_task_t *take_task(imn_pool_t *pool, int deque_idx, bool is_owner) {
+
+    imn_task_deque_t *deque;
+    imn_dir_task_t *task;
+
+    deque = &pool->deque_list[deque_idx];
+    task = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+
+    // Owner works depth-first from the tail; thieves take the oldest
+    if (deque->head < deque->tail) {
+        if (is_owner) {
+            task = deque->task_list[--deque->tail];
+        } else {
+            task = deque->task_list[deque->head++];
+        }
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+
+    if (task != NULL) {
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+    return task;
+}
+
+static
+void fail_pool(imn_pool_t *pool, imn_error_t status) {
+
+    pthread_mutex_lock(&pool->idle_lock);
+
+    if (pool->status == IMN_OK) {
+        pool->status = status;
+    }
+    atomic_store(&pool->abort, true);
+
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+static
+imn_error_t append_entry(imn_dir_task_t *task, imn_record_t *record,
+        imn_dir_task_t *subdir) {
+
+    imn_error_t ret_val;
+    imn_task_entry_t *entry;
+
+    entry = arena_alloc(&task->arena, sizeof(*entry));
+    if (entry == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_normal;
+    }
+
+    entry->subdir = subdir;
+    entry->link = NULL;
+
+    if (subdir == NULL) {
+        ret_val = clone_record(&entry->record, record, &task->arena);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+        entry->record.parent_dir = &task->record;
+    }
+
+    *task->entry_tail = entry;
+    task->entry_tail = &entry->link;
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t scan_task(imn_worker_t *worker, imn_dir_task_t *task) {
+
+    imn_error_t ret_val;
+    imn_pool_t *pool;
+
+    imn_extent_t *cur_extent;
+    imn_record_t cur_record;
+    imn_dir_task_t *child;
+    imn_arena_mark_t scope_mark;
+    imn_range_t range;
+
+    uint16_t block_size;
+    int call_ret;
+
+    pool = worker->pool;
+    block_size = worker->iso->desc->block_size;
+    scope_mark = arena_mark(&worker->arena);
+    scan_begin(worker->iso, &task->record);
+
+    for (cur_extent = task->record.extent_list; cur_extent != NULL;
+            cur_extent = cur_extent->link) {
+
+        range.start = (off_t) cur_extent->lba_offset * block_size;
+        range.end = range.start + cur_extent->data_length;
+
+        ret_val = set_read_window(worker->iso, &worker->block_buf,
+                    cur_extent->lba_offset,
+                    (cur_extent->data_length + block_size - 1) / block_size);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        while (range.start < range.end) {
+
+            if (atomic_load(&pool->abort)) {
+                ret_val = IMN_OK;
+                goto exit_normal;
+            }
+
+            ret_val = search_record(&cur_record, worker->iso,
+                                        &worker->block_buf, &worker->arena,
+                                        &task->record, &range);
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
 
-    while (multi_extent) {
+            if (cur_record.extent_num == 0) break;
+            range.start = cur_record.extent_span.end;
 
-        local_range.start = cur_loc;
-        ret_val = search_raw_record(&rec_wrapper, iso, &local_range, false);
+            if (!cur_record.is_dir) {
+
+                if (pool->ordered) {
+                    ret_val = append_entry(task, &cur_record, NULL);
+                    if (ret_val != IMN_OK) {
+                        goto exit_normal;
+                    }
+
+                } else {
+
+                    call_ret = pool->callback->fn(&cur_record,
+                                                    pool->callback->args);
+                    if (call_ret < 0) {
+                        ret_val = IMN_CALLBACK_ERR;
+                        goto exit_normal;
+                    }
+                }
+
+            } else if (cur_record.record_id[0] != '\0' &&
+                        cur_record.record_id[0] != '\1') {
+
+                // Ordered mode keeps an extra reference for the emitter
+                ret_val = new_task(&child, &cur_record, task,
+                                    pool->ordered ? 2 : 1);
+                if (ret_val != IMN_OK) {
+                    goto exit_normal;
+                }
+
+                if (pool->ordered) {
+                    ret_val = append_entry(task, NULL, child);
+                    if (ret_val != IMN_OK) {
+                        release_task(child);
+                        release_task(child);
+                        goto exit_normal;
+                    }
+                }
+
+                ret_val = push_task(worker, child);
+                if (ret_val != IMN_OK) {
+                    // Emitter still walks the entry; mark it finished
+                    child->is_done = true;
+                    release_task(child);
+                    goto exit_normal;
+                }
+            }
+
+            arena_rewind(&worker->arena, scope_mark);
+        }
+    }
+
+    ret_val = IMN_OK;
+    exit_normal:
+        scan_end(worker->iso, &task->record, ret_val);
+        arena_rewind(&worker->arena, scope_mark);
+        return ret_val;
+}
+
+static
+void run_task(imn_worker_t *worker, imn_dir_task_t *task) {
+
+    imn_error_t ret_val;
+    imn_pool_t *pool;
+
+    pool = worker->pool;
+
+    if (!atomic_load(&pool->abort)) {
+        ret_val = scan_task(worker, task);
         if (ret_val != IMN_OK) {
-            goto exit_extents;
+            fail_pool(pool, ret_val);
         }
-        raw_rec = rec_wrapper.raw_rec;
+    }
 
-        // ISO-9660 violation: Addditional extent does not exist
-        if (raw_rec == NULL) {
+    if (pool->ordered) {
+        pthread_mutex_lock(&pool->idle_lock);
+        task->is_done = true;
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+
+    release_task(task);
+
+    if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_broadcast(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+static
+void *worker_main(void *args) {
+
+    imn_worker_t *worker;
+    imn_pool_t *pool;
+    imn_dir_task_t *task;
+    int steal_idx, victim;
+
+    worker = args;
+    pool = worker->pool;
+
+    while (true) {
+
+        task = take_task(pool, worker->worker_id, true);
+
+        for (steal_idx = 1; task == NULL && steal_idx < pool->worker_num;
+                steal_idx++) {
+            victim = (worker->worker_id + steal_idx) % pool->worker_num;
+            task = take_task(pool, victim, false);
+        }
+
+        if (task != NULL) {
+            run_task(worker, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->idle_lock);
+
+        while (atomic_load(&pool->pending) > 0 &&
+                atomic_load(&pool->queued) == 0) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+
+        if (atomic_load(&pool->pending) == 0) {
+            pthread_mutex_unlock(&pool->idle_lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+
+    return NULL;
+}
+
+static
+void emit_task(imn_pool_t *pool, imn_dir_task_t *task) {
+
+    imn_task_entry_t *entry;
+    int call_ret;
+
+    pthread_mutex_lock(&pool->idle_lock);
+    while (!task->is_done) {
+        pthread_cond_wait(&pool->done_cond, &pool->idle_lock);
+    }
+    pthread_mutex_unlock(&pool->idle_lock);
+
+    // Subdirectories are still walked after an abort to drop references
+    for (entry = task->entry_list; entry != NULL; entry = entry->link) {
+
+        if (entry->subdir != NULL) {
+            emit_task(pool, entry->subdir);
+
+        } else if (!atomic_load(&pool->abort)) {
+
+            call_ret = pool->callback->fn(&entry->record,
+                                            pool->callback->args);
+            if (call_ret < 0) {
+                fail_pool(pool, IMN_CALLBACK_ERR);
+            }
+        }
+    }
+
+    release_task(task);
+}
+
+static
+imn_error_t init_worker(imn_worker_t *worker, imn_pool_t *pool,
+        int worker_id) {
+
+    imn_error_t ret_val;
+
+    worker->pool = pool;
+    worker->worker_id = worker_id;
+
+    // Read paths keep no state in the handle, so workers share it as-is
+    worker->iso = pool->iso;
+
+    ret_val = init_block_buf(worker->iso, &worker->block_buf);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+    init_arena(&worker->arena, worker->iso->stats);
+
+    ret_val = IMN_OK;
+    exit_normal:
+        return ret_val;
+}
+
+static
+void free_worker(imn_worker_t *worker) {
+    free_arena(&worker->arena);
+    free_block_buf(&worker->block_buf);
+}
+
+imn_error_t imn_traverse_parallel(imn_iso_t *iso, imn_record_t *dir_record,
+        imn_callback_t *callback, int thread_num, bool ordered) {
+
+    imn_error_t ret_val;
+    imn_pool_t pool;
+    imn_worker_t *worker_list;
+    imn_dir_task_t *root_task;
+    pthread_t *thread_list;
+
+    int worker_idx, ready_num, started_num;
+
+    if (iso == NULL || dir_record == NULL || callback == NULL) {
+        ret_val = IMN_ARGS_ERR;
+        goto exit_normal;
+    }
+
+    if (!dir_record->is_dir) {
+        ret_val = IMN_DIR_ERR;
+        goto exit_normal;
+    }
+
+    if (thread_num <= 0) {
+        thread_num = sysconf(_SC_NPROCESSORS_ONLN);
+        if (thread_num <= 0) {
+            thread_num = 1;
+        }
+    }
+
+    pool.iso = iso;
+    pool.callback = callback;
+    pool.ordered = ordered;
+    pool.worker_num = thread_num;
+    pool.status = IMN_OK;
+
+    atomic_init(&pool.pending, 0);
+    atomic_init(&pool.queued, 0);
+    atomic_init(&pool.abort, false);
+
+    pthread_mutex_init(&pool.idle_lock, NULL);
+    pthread_cond_init(&pool.idle_cond, NULL);
+    pthread_cond_init(&pool.done_cond, NULL);
+
+    pool.deque_list = calloc(thread_num, sizeof(*pool.deque_list));
+    worker_list = calloc(thread_num, sizeof(*worker_list));
+    thread_list = calloc(thread_num, sizeof(*thread_list));
+
+    if (pool.deque_list == NULL || worker_list == NULL ||
+            thread_list == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_lists;
+    }
+
+    for (worker_idx = 0; worker_idx < thread_num; worker_idx++) {
+        pthread_mutex_init(&pool.deque_list[worker_idx].lock, NULL);
+    }
+
+    for (ready_num = 0; ready_num < thread_num; ready_num++) {
+        ret_val = init_worker(&worker_list[ready_num], &pool, ready_num);
+        if (ret_val != IMN_OK) {
+            goto exit_workers;
+        }
+    }
+
+    ret_val = new_task(&root_task, dir_record, NULL, ordered ? 2 : 1);
+    if (ret_val != IMN_OK) {
+        goto exit_workers;
+    }
+
+    ret_val = push_task(&worker_list[0], root_task);
+    if (ret_val != IMN_OK) {
+        // Drop the queue's reference, plus the emitter's when ordered
+        release_task(root_task);
+        if (ordered) {
+            release_task(root_task);
+        }
+        goto exit_workers;
+    }
+
+    for (started_num = 0; started_num < thread_num; started_num++) {
+        if (pthread_create(&thread_list[started_num], NULL, worker_main,
+                            &worker_list[started_num]) != 0) {
+            fail_pool(&pool, IMN_THREAD_ERR);
+            break;
+        }
+    }
+
+    // No worker at all means nobody will ever finish the root task
+    if (started_num == 0) {
+        take_task(&pool, 0, true);
+        run_task(&worker_list[0], root_task);
+    }
+
+    // Ordered mode replays the tree depth-first on the calling thread
+    if (ordered) {
+        emit_task(&pool, root_task);
+    }
+
+    for (worker_idx = 0; worker_idx < started_num; worker_idx++) {
+        pthread_join(thread_list[worker_idx], NULL);
+    }
+
+    ret_val = pool.status;
+
+    exit_workers:
+        for (worker_idx = 0; worker_idx < ready_num; worker_idx++) {
+            free_worker(&worker_list[worker_idx]);
+        }
+        for (worker_idx = 0; worker_idx < thread_num; worker_idx++) {
+            pthread_mutex_destroy(&pool.deque_list[worker_idx].lock);
+            free(pool.deque_list[worker_idx].task_list);
+        }
+    exit_lists:
+        free(thread_list);
+        free(worker_list);
+        free(pool.deque_list);
+
+        pthread_cond_destroy(&pool.done_cond);
+        pthread_cond_destroy(&pool.idle_cond);
+        pthread_mutex_destroy(&pool.idle_lock);
+    exit_normal:
+        return ret_val;
+}
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static
+uint32_t rotr32(uint32_t num, int shift) {
+    return (num >> shift) | (num << (32 - shift));
+}
+
+static
+void sha256_init(imn_sha256_t *ctx) {
+
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+
+    ctx->length = 0;
+    ctx->block_len = 0;
+}
+
+static
+void sha256_block(imn_sha256_t *ctx, uint8_t *block) {
+
+    uint32_t sched[64];
+    uint32_t var[8];
+    uint32_t sum0, sum1, temp1, temp2;
+    int idx;
+
+    for (idx = 0; idx < 16; idx++) {
+        sched[idx] = ((uint32_t) block[idx * 4] << 24)
+                   | ((uint32_t) block[idx * 4 + 1] << 16)
+                   | ((uint32_t) block[idx * 4 + 2] << 8)
+                   | ((uint32_t) block[idx * 4 + 3]);
+    }
+
+    for (idx = 16; idx < 64; idx++) {
+        sum0 = rotr32(sched[idx - 15], 7) ^ rotr32(sched[idx - 15], 18)
+             ^ (sched[idx - 15] >> 3);
+        sum1 = rotr32(sched[idx - 2], 17) ^ rotr32(sched[idx - 2], 19)
+             ^ (sched[idx - 2] >> 10);
+        sched[idx] = sched[idx - 16] + sum0 + sched[idx - 7] + sum1;
+    }
+
+    memcpy(var, ctx->state, sizeof(var));
+
+    for (idx = 0; idx < 64; idx++) {
+        sum1 = rotr32(var[4], 6) ^ rotr32(var[4], 11) ^ rotr32(var[4], 25);
+        temp1 = var[7] + sum1 + ((var[4] & var[5]) ^ (~var[4] & var[6]))
+              + sha256_k[idx] + sched[idx];
+        sum0 = rotr32(var[0], 2) ^ rotr32(var[0], 13) ^ rotr32(var[0], 22);
+        temp2 = sum0 + ((var[0] & var[1]) ^ (var[0] & var[2])
+              ^ (var[1] & var[2]));
+
+        var[7] = var[6];
+        var[6] = var[5];
+        var[5] = var[4];
+        var[4] = var[3] + temp1;
+        var[3] = var[2];
+        var[2] = var[1];
+        var[1] = var[0];
+        var[0] = temp1 + temp2;
+    }
+
+    for (idx = 0; idx < 8; idx++) {
+        ctx->state[idx] += var[idx];
+    }
+}
+
+static
+void sha256_update(imn_sha256_t *ctx, uint8_t *data, size_t length) {
+
+    size_t take;
+
+    ctx->length += length;
+
+    // Top up a partial block first, then go straight from the input
+    if (ctx->block_len != 0) {
+        take = 64 - ctx->block_len;
+        take = (length < take) ? length : take;
+
+        memcpy(ctx->block + ctx->block_len, data, take);
+        ctx->block_len += take;
+        data += take;
+        length -= take;
+
+        if (ctx->block_len < 64) {
+            return;
+        }
+        sha256_block(ctx, ctx->block);
+        ctx->block_len = 0;
+    }
+
+    while (length >= 64) {
+        sha256_block(ctx, data);
+        data += 64;
+        length -= 64;
+    }
+
+    memcpy(ctx->block, data, length);
+    ctx->block_len = length;
+}
+
+static
+void sha256_final(imn_sha256_t *ctx, uint8_t *digest) {
+
+    uint64_t bit_len;
+    int idx;
+
+    bit_len = ctx->length * 8;
+
+    ctx->block[ctx->block_len++] = 0x80;
+    if (ctx->block_len > 56) {
+        memset(ctx->block + ctx->block_len, 0, 64 - ctx->block_len);
+        sha256_block(ctx, ctx->block);
+        ctx->block_len = 0;
+    }
+
+    memset(ctx->block + ctx->block_len, 0, 56 - ctx->block_len);
+    for (idx = 0; idx < 8; idx++) {
+        ctx->block[56 + idx] = (uint8_t) (bit_len >> (56 - idx * 8));
+    }
+    sha256_block(ctx, ctx->block);
+
+    for (idx = 0; idx < 32; idx++) {
+        digest[idx] = (uint8_t) (ctx->state[idx / 4] >> (24 - (idx % 4) * 8));
+    }
+}
+
+static
+void hash_update(imn_hash_job_t *job, imn_hash_file_t *file, uint8_t *data,
+        size_t length) {
+
+    if (job->hash_flags & HASH_CRC32) {
+        file->crc32 = crc32(file->crc32, data, length);
+    }
+
+    if (job->hash_flags & HASH_SHA256) {
+        sha256_update(&file->sha256, data, length);
+    }
+}
+
+// Callbacks are serialized so they can append to a shared manifest
+static
+imn_error_t emit_hash(imn_hash_job_t *job, imn_hash_file_t *file) {
+
+    imn_hash_result_t result;
+    int call_ret;
+
+    result.path = job->path_pool + file->path_offset;
+    result.path_len = file->path_len;
+    result.size = file->size;
+    result.crc32 = 0;
+    memset(result.sha256, 0, sizeof(result.sha256));
+
+    if (job->hash_flags & HASH_CRC32) {
+        result.crc32 = file->crc32;
+    }
+
+    if (job->hash_flags & HASH_SHA256) {
+        sha256_final(&file->sha256, result.sha256);
+    }
+
+    pthread_mutex_lock(&job->emit_lock);
+    call_ret = job->callback->fn(&result, job->callback->args);
+    pthread_mutex_unlock(&job->emit_lock);
+
+    return (call_ret < 0) ? IMN_CALLBACK_ERR : IMN_OK;
+}
+
+static
+void fail_hash(imn_hash_job_t *job, imn_error_t status) {
+
+    pthread_mutex_lock(&job->lock);
+    if (job->status == IMN_OK) {
+        job->status = status;
+    }
+    atomic_store(&job->abort, true);
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+// Feeds a file's contents through imn_pread, inflating zisofs blocks
+static
+imn_error_t hash_opened(imn_hash_job_t *job, imn_hash_file_t *file,
+        imn_file_t *open_file, uint8_t *buffer, size_t buffer_len) {
+
+    imn_error_t ret_val;
+    size_t read_len;
+    off_t offset;
+
+    for (offset = 0; offset < open_file->total_size; offset += read_len) {
+
+        ret_val = imn_pread(open_file, buffer, buffer_len, offset, &read_len);
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        if (read_len == 0) {
             ret_val = IMN_STD_ERR;
-            goto exit_extents;
+            goto exit_normal;
         }
+        hash_update(job, file, buffer, read_len);
+    }
 
-        cur_extent->link = malloc(sizeof(*cur_extent));
-        if (cur_extent->link == NULL) {
+    file->size = open_file->total_size;
+    ret_val = IMN_OK;
+
+    exit_normal:
+        return ret_val;
+}
+
+static
+imn_error_t hash_inline(imn_hash_job_t *job, imn_hash_file_t *file,
+        imn_record_t *record) {
+
+    imn_error_t ret_val;
+    imn_file_t open_file;
+
+    if (job->scratch == NULL) {
+        job->scratch = malloc(HASH_RUN_SIZE);
+        if (job->scratch == NULL) {
             ret_val = IMN_ALLOC_ERR;
-            goto exit_extents;
+            goto exit_normal;
         }
-        cur_extent = cur_extent->link;
-
-        cur_extent->lba_offset = LE_int32(&raw_rec->block[0]);
-        cur_extent->data_length = LE_int32(&raw_rec->length[0]);
-        cur_extent->link = NULL;
-        
-        record->extent_num += 1;
-        record->total_size += cur_extent->data_length;
+        STAT_ADD(job->iso->stats, allocs, 1);
+    }
 
-        cur_loc = rec_wrapper.rec_offset + raw_rec->len_dr[0];
-        record->extent_span.end = cur_loc;
+    ret_val = imn_open(job->iso, record, &open_file);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
 
-        multi_extent = (raw_rec->flags[0] & 0x80);
-        free_rec_wrapper(&rec_wrapper);
+    ret_val = hash_opened(job, file, &open_file, job->scratch,
+                            HASH_RUN_SIZE);
+    imn_close_file(&open_file);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
     }
 
-    ret_val = IMN_OK;
-    goto exit_normal;
+    ret_val = emit_hash(job, file);
 
-    exit_extents:
-        free_extents(cur_extent);
-    exit_wrapper:
-        free_rec_wrapper(&rec_wrapper);
     exit_normal:
         return ret_val;
 }
 
+// Plain files are ruled out by their first bytes; imn_open then applies
+// the full header and ZF checks to the few that carry the magic
 static
-imn_error_t retrieve_desc(imn_vol_desc_t *desc, FILE *iso_file, off_t loc) {
+imn_error_t probe_ziso(imn_hash_job_t *job, imn_record_t *record,
+        off_t size, bool *is_ziso) {
 
     imn_error_t ret_val;
+    imn_file_t open_file;
+    imn_extent_t *first_extent;
+    uint8_t magic[8];
 
-    imn_rawrec_wrapper_t rec_wrapper;
-    imn_raw_vol_t raw_descriptor;
-    imn_record_t *root_dir;
-    imn_range_t range;
-
-    size_t read_ret;
-    int seek_ret;
-
-    if (desc == NULL || iso_file == NULL || loc < 0) {
-        ret_val = IMN_CODE_ERR;
+    *is_ziso = false;
+    if (size < ZISO_HEADER_SIZE) {
+        ret_val = IMN_OK;
         goto exit_normal;
     }
 
-    seek_ret = fseeko(iso_file, loc, SEEK_SET);
-    if (seek_ret != 0) {
-        ret_val = IMN_ACCESS_ERR;
-        goto exit_normal;
+    first_extent = record->extent_list;
+    if (first_extent->data_length >= sizeof(magic)) {
+
+        ret_val = read_bytes(job->iso, (off_t) first_extent->lba_offset *
+                                job->iso->desc->block_size, sizeof(magic),
+                                magic);
+        if (ret_val != IMN_OK || memcmp(magic, ZISO_MAGIC, 8) != 0) {
+            goto exit_normal;
+        }
     }
 
-    read_ret = fread(&raw_descriptor, sizeof(raw_descriptor), 1, iso_file);
-    if (read_ret != 1) {
-        ret_val = IMN_ACCESS_ERR;
+    ret_val = imn_open(job->iso, record, &open_file);
+    if (ret_val != IMN_OK) {
         goto exit_normal;
     }
 
-    desc->block_size = LE_int16(&raw_descriptor.block_size[0]);
-    desc->path_table_size = LE_int32(&raw_descriptor.path_table_size[0]);
-    desc->path_table_lba = LE_int32(&raw_descriptor.l_path_table_pos[0]);
-    desc->lba_size = LE_int32(&raw_descriptor.vol_space_size[0]);
+    *is_ziso = (open_file.ziso != NULL);
+    imn_close_file(&open_file);
 
-    root_dir = malloc(sizeof(*root_dir));
-    if (root_dir == NULL) {
-        ret_val = IMN_ALLOC_ERR;
+    exit_normal:
+        return ret_val;
+}
+
+// zisofs files skip the runs; a worker reopens each one from its own
+// copy of the record and hashes the inflated stream
+static
+imn_error_t push_ziso(imn_hash_job_t *job, uint32_t file_idx,
+        imn_record_t *record) {
+
+    imn_error_t ret_val;
+    imn_hash_ziso_t *ziso;
+
+    ret_val = reserve_items((void **) &job->ziso_list, &job->ziso_cap,
+                                job->ziso_num + 1, sizeof(*ziso));
+    if (ret_val != IMN_OK) {
         goto exit_normal;
     }
 
-    rec_wrapper.raw_rec = (imn_raw_record_t *) &raw_descriptor.root_dir_record;
-    rec_wrapper.rec_offset = loc + offsetof(imn_raw_vol_t, root_dir_record);
-    rec_wrapper.id_length = 0;
-    rec_wrapper.record_id = "\0";
+    ziso = &job->ziso_list[job->ziso_num];
+    ziso->file_idx = file_idx;
 
-    ret_val = handle_lead_extent(root_dir, &rec_wrapper, NULL);
+    ret_val = clone_record(&ziso->record, record, NULL);
     if (ret_val != IMN_OK) {
-        goto exit_root;
+        goto exit_normal;
     }
-    desc->root_dir = root_dir;
-
-    ret_val = IMN_OK;
-    goto exit_normal;
+    job->ziso_num++;
 
-    exit_root:
-        free(root_dir);
     exit_normal:
         return ret_val;
-
 }
 
-imn_error_t imn_init(imn_iso_t *iso, char *iso_path, bool is_header) {
+static
+imn_error_t hash_ziso(imn_hash_job_t *job, imn_hash_ziso_t *ziso,
+        uint8_t *buffer) {
 
     imn_error_t ret_val;
-    imn_vol_desc_t *desc;
-    FILE *iso_file;
+    imn_hash_file_t *file;
+    imn_file_t open_file;
 
-    if (iso == NULL || iso_path == NULL) {
-        ret_val = IMN_ARGS_ERR;
+    file = &job->file_list[ziso->file_idx];
+
+    ret_val = imn_open(job->iso, &ziso->record, &open_file);
+    if (ret_val != IMN_OK) {
         goto exit_normal;
     }
 
-    iso_file = fopen(iso_path, "r");
-    if (iso_file == NULL) {
-        ret_val = IMN_PATH_ERR;
+    ret_val = hash_opened(job, file, &open_file, buffer, HASH_RUN_SIZE);
+    imn_close_file(&open_file);
+    if (ret_val != IMN_OK) {
         goto exit_normal;
     }
 
-    desc = malloc(sizeof(*desc));
-    if (desc == NULL) {
-        ret_val = IMN_ALLOC_ERR;
-        goto exit_file;
-    }
+    ret_val = emit_hash(job, file);
 
-    ret_val = retrieve_desc(desc, iso_file, JOLIET_OFFSET);
-    if (ret_val != IMN_OK) {
-        goto exit_desc;
-    }
+    exit_normal:
+        return ret_val;
+}
 
-    iso->iso_file = iso_file;
-    iso->desc = desc;
+static
+imn_error_t push_segments(imn_hash_job_t *job, uint32_t file_idx,
+        imn_record_t *record) {
 
-    ret_val = IMN_OK;
-    goto exit_normal;
+    imn_error_t ret_val;
+    imn_extent_t *cur_extent;
+    imn_hash_seg_t *seg;
+    off_t disk_offset, rel_offset, done;
+    size_t length;
 
-    exit_file:
-        fclose(iso_file);
-    exit_desc:
-        free(desc);
+    rel_offset = 0;
+    for (cur_extent = record->extent_list; cur_extent != NULL;
+            cur_extent = cur_extent->link) {
+
+        disk_offset = (off_t) cur_extent->lba_offset *
+                            job->iso->desc->block_size;
+
+        // Oversized extents are split so that any one segment fits a run
+        for (done = 0; done < cur_extent->data_length; done += length) {
+            length = cur_extent->data_length - done;
+            length = (length < HASH_RUN_SIZE) ? length : HASH_RUN_SIZE;
+
+            ret_val = reserve_items((void **) &job->seg_list, &job->seg_cap,
+                                        job->seg_num + 1, sizeof(*seg));
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
+
+            seg = &job->seg_list[job->seg_num++];
+            seg->disk_offset = disk_offset + done;
+            seg->rel_offset = rel_offset + done;
+            seg->length = length;
+            seg->file_idx = file_idx;
+        }
+
+        rel_offset += cur_extent->data_length;
+    }
+
+    ret_val = IMN_OK;
     exit_normal:
         return ret_val;
 }
 
-imn_error_t imn_traverse_dir(imn_iso_t *iso, imn_record_t *dir_record,
-        imn_callback_t *callback, bool recursive) {
-    
-    imn_error_t ret_val;
+static
+int collect_file(imn_record_t *record, char *path, size_t path_len,
+        void *args) {
 
+    imn_error_t ret_val;
+    imn_hash_job_t *job;
+    imn_hash_file_t *file;
     imn_extent_t *cur_extent;
-    imn_record_t cur_record;
-    imn_range_t range;
+    off_t disk_offset, prev_end;
+    bool is_ordered, is_ziso;
 
-    uint16_t block_size;
+    job = args;
+    if (record->is_dir) {
+        return 0;
+    }
 
-    int call_ret;
+    ret_val = reserve_items((void **) &job->file_list, &job->file_cap,
+                                job->file_num + 1, sizeof(*file));
+    if (ret_val != IMN_OK) {
+        goto exit_error;
+    }
 
-    if (iso == NULL || dir_record == NULL || callback == NULL) {
-        ret_val = IMN_ARGS_ERR;
-        goto exit_normal;
+    ret_val = reserve_items((void **) &job->path_pool, &job->pool_cap,
+                                job->pool_len + path_len + 1, sizeof(char));
+    if (ret_val != IMN_OK) {
+        goto exit_error;
     }
 
-    if (!dir_record->is_dir) {
-        ret_val = IMN_DIR_ERR;
-        goto exit_normal;
+    file = &job->file_list[job->file_num];
+    file->path_offset = job->pool_len;
+    file->path_len = path_len;
+    file->size = 0;
+    file->hashed = 0;
+    file->crc32 = crc32(0L, Z_NULL, 0);
+    sha256_init(&file->sha256);
+
+    memcpy(job->path_pool + job->pool_len, path, path_len + 1);
+    job->pool_len += path_len + 1;
+
+    // Workers need each file's pieces to come up in file order on disk
+    is_ordered = true;
+    prev_end = 0;
+    for (cur_extent = record->extent_list; cur_extent != NULL;
+            cur_extent = cur_extent->link) {
+
+        if (cur_extent->data_length == 0) {
+            continue;
+        }
+
+        disk_offset = (off_t) cur_extent->lba_offset *
+                            job->iso->desc->block_size;
+        if (disk_offset < prev_end) {
+            is_ordered = false;
+        }
+
+        prev_end = disk_offset + cur_extent->data_length;
+        file->size += cur_extent->data_length;
     }
 
-    block_size = iso->desc->block_size;
-    cur_extent = dir_record->extent_list;
+    job->file_num++;
 
-    // Handle multi-extent dirs
-    while (cur_extent != NULL) {
+    // Out-of-order files go through imn_pread, which inflates on its own
+    if (file->size == 0) {
+        ret_val = emit_hash(job, file);
+    } else if (!is_ordered) {
+        ret_val = hash_inline(job, file, record);
+    } else {
+        ret_val = probe_ziso(job, record, file->size, &is_ziso);
+        if (ret_val == IMN_OK) {
+            ret_val = is_ziso ? push_ziso(job, job->file_num - 1, record) :
+                            push_segments(job, job->file_num - 1, record);
+        }
+    }
 
-        range.start = cur_extent->lba_offset * block_size;
-        range.end = range.start + cur_extent->data_length;
+    if (ret_val != IMN_OK) {
+        goto exit_error;
+    }
 
-        while (range.start < range.end) {
+    return 0;
 
-            ret_val = search_record(&cur_record, iso, dir_record, &range);
-            if (ret_val != IMN_OK) {
-                goto exit_normal;
-            }
+    exit_error:
+        job->status = ret_val;
+        return -1;
+}
 
-            if (cur_record.extent_num == 0) break;
-            range.start = cur_record.extent_span.end;
+static
+int compare_segs(const void *first, const void *second) {
 
-            if (!cur_record.is_dir) {
-                call_ret = callback->fn(&cur_record, callback->args);
-                if (call_ret < 0) {
-                    ret_val = IMN_CALLBACK_ERR;
-                    goto exit_normal;
-                }
+    const imn_hash_seg_t *seg_a = first;
+    const imn_hash_seg_t *seg_b = second;
 
-            } else if (recursive &&
-                        cur_record.record_id[0] != '\0' &&
-                        cur_record.record_id[0] != '\1') {
+    if (seg_a->disk_offset != seg_b->disk_offset) {
+        return (seg_a->disk_offset < seg_b->disk_offset) ? -1 : 1;
+    }
 
-                ret_val = imn_traverse_dir(iso, &cur_record,
-                                            callback, recursive);
+    if (seg_a->file_idx != seg_b->file_idx) {
+        return (seg_a->file_idx < seg_b->file_idx) ? -1 : 1;
+    }
 
-                if (ret_val != IMN_OK) {
-                    goto exit_normal;
-                }
-            }
+    return 0;
+}
+
+static
+imn_error_t build_runs(imn_hash_job_t *job) {
+
+    imn_error_t ret_val;
+    imn_hash_seg_t *seg;
+    imn_hash_run_t *run;
+    off_t run_end, seg_end;
+    size_t seg_idx;
+
+    // Nothing to sort, and qsort must not see the NULL list
+    if (job->seg_num == 0) {
+        ret_val = IMN_OK;
+        goto exit_normal;
+    }
+
+    qsort(job->seg_list, job->seg_num, sizeof(*job->seg_list), compare_segs);
+
+    run = NULL;
+    run_end = 0;
+    for (seg_idx = 0; seg_idx < job->seg_num; seg_idx++) {
+
+        seg = &job->seg_list[seg_idx];
+        seg_end = seg->disk_offset + seg->length;
+        if (seg_end < run_end) {
+            seg_end = run_end;
         }
-        cur_extent = cur_extent->link;        
+
+        // Small gaps are cheaper to read through than to seek over
+        if (run != NULL && seg->disk_offset <= run_end + HASH_GAP_MAX &&
+                seg_end - run->disk_offset <= HASH_RUN_SIZE) {
+
+            run->length = seg_end - run->disk_offset;
+            run->seg_num++;
+            run_end = seg_end;
+            continue;
+        }
+
+        ret_val = reserve_items((void **) &job->run_list, &job->run_cap,
+                                    job->run_num + 1, sizeof(*run));
+        if (ret_val != IMN_OK) {
+            goto exit_normal;
+        }
+
+        run = &job->run_list[job->run_num++];
+        run->disk_offset = seg->disk_offset;
+        run->length = seg->length;
+        run->first_seg = seg_idx;
+        run->seg_num = 1;
+        run_end = seg->disk_offset + seg->length;
     }
 
+    ret_val = IMN_OK;
     exit_normal:
         return ret_val;
 }
 
-imn_error_t imn_get_extents(imn_record_t *dir_record,
-        imn_user_extent_t *list, int list_size) {
+static
+imn_error_t hash_run(imn_hash_job_t *job, imn_hash_run_t *run,
+        uint8_t *buffer) {
 
     imn_error_t ret_val;
-    imn_extent_t *cur_extent;
-    int list_index;
-    off_t rel_offset;
-
-    if (list == NULL || dir_record == NULL) {
-        ret_val = IMN_ARGS_ERR;
-        goto exit_normal;
+    imn_hash_seg_t *seg;
+    imn_hash_file_t *file;
+    uint8_t *data;
+    size_t seg_idx;
+    bool is_last;
+
+    if (job->iso->iso_map != NULL) {
+        ret_val = map_range(job->iso, run->disk_offset, run->length, &data);
+    } else {
+        data = buffer;
+        ret_val = read_bytes(job->iso, run->disk_offset, run->length, data);
     }
 
-    if (list_size < dir_record->extent_num) {
-        ret_val = IMN_ARGS_ERR;
+    if (ret_val != IMN_OK) {
         goto exit_normal;
     }
 
-    list_index = 0;
-    cur_extent = dir_record->extent_list;
-    while (cur_extent != NULL) {
-        list[list_index].lba_offset = cur_extent->lba_offset;
-        list[list_index].data_length = cur_extent->data_length;
-        list[list_index].file_name = dir_record->record_id;
-        list[list_index].rel_offset = rel_offset;
+    for (seg_idx = run->first_seg; seg_idx < run->first_seg + run->seg_num;
+            seg_idx++) {
 
-        rel_offset += list[list_index].data_length;
-        cur_extent = cur_extent->link;
-        list_index++;
+        seg = &job->seg_list[seg_idx];
+        file = &job->file_list[seg->file_idx];
+
+        // Earlier pieces sit at lower offsets, so whoever holds them
+        // is never waiting on this run in turn
+        pthread_mutex_lock(&job->lock);
+        while (file->hashed != seg->rel_offset &&
+                !atomic_load(&job->abort)) {
+            pthread_cond_wait(&job->cond, &job->lock);
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        if (atomic_load(&job->abort)) {
+            ret_val = IMN_OK;
+            goto exit_normal;
+        }
+
+        hash_update(job, file, data + (seg->disk_offset - run->disk_offset),
+                        seg->length);
+
+        pthread_mutex_lock(&job->lock);
+        file->hashed += seg->length;
+        is_last = (file->hashed == file->size);
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+
+        if (is_last) {
+            ret_val = emit_hash(job, file);
+            if (ret_val != IMN_OK) {
+                goto exit_normal;
+            }
+        }
     }
 
+    ret_val = IMN_OK;
     exit_normal:
         return ret_val;
 }
 
-imn_error_t imn_get_path(imn_record_t *record, char *buffer, int buffer_size) {
+static
+void *hash_main(void *args) {
 
     imn_error_t ret_val;
-    int str_pos, path_len;
-    imn_record_t *cur_dir;
+    imn_hash_job_t *job;
+    uint8_t *buffer;
+    size_t run_idx, ziso_idx;
+
+    job = args;
+    buffer = NULL;
+
+    // Mapped runs need no buffer, but inflating still does
+    if (job->iso->iso_map == NULL || job->ziso_num > 0) {
+        buffer = malloc(HASH_RUN_SIZE);
+        if (buffer == NULL) {
+            fail_hash(job, IMN_ALLOC_ERR);
+            return NULL;
+        }
+        STAT_ADD(job->iso->stats, allocs, 1);
+    }
+
+    // Runs are claimed in LBA order, keeping the device streaming
+    while (!atomic_load(&job->abort)) {
+
+        run_idx = atomic_fetch_add(&job->next_run, 1);
+        if (run_idx >= job->run_num) {
+            break;
+        }
+
+        ret_val = hash_run(job, &job->run_list[run_idx], buffer);
+        if (ret_val != IMN_OK) {
+            fail_hash(job, ret_val);
+        }
+    }
+
+    // zisofs files come last, once the streaming reads are done
+    while (!atomic_load(&job->abort)) {
+
+        ziso_idx = atomic_fetch_add(&job->next_ziso, 1);
+        if (ziso_idx >= job->ziso_num) {
+            break;
+        }
+
+        ret_val = hash_ziso(job, &job->ziso_list[ziso_idx], buffer);
+        if (ret_val != IMN_OK) {
+            fail_hash(job, ret_val);
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+imn_error_t imn_hash_all(imn_iso_t *iso, imn_record_t *dir_record,
+        uint32_t hash_flags, imn_hash_callback_t *callback, int thread_num) {
+
+    imn_error_t ret_val;
+    imn_hash_job_t job;
+    imn_path_callback_t collect;
+    pthread_t *thread_list;
 
-    imn_cpath_t *path_header, *tmp_segment;
+    size_t ziso_idx;
+    int worker_idx, started_num;
 
-    if (buffer == NULL || record == NULL) {
+    if (iso == NULL || dir_record == NULL || callback == NULL) {
         ret_val = IMN_ARGS_ERR;
         goto exit_normal;
     }
 
-    if (record->parent_dir == NULL) {
-        ret_val = IMN_CODE_ERR;
+    if (!dir_record->is_dir) {
+        ret_val = IMN_DIR_ERR;
         goto exit_normal;
     }
 
-    cur_dir = record;
-    path_header = NULL;
+    if (thread_num <= 0) {
+        thread_num = sysconf(_SC_NPROCESSORS_ONLN);
+        if (thread_num <= 0) {
+            thread_num = 1;
+        }
+    }
 
-    // Build directory linked list
-    path_len = -1;
-    while (cur_dir != NULL) {
+    memset(&job, 0, sizeof(job));
+    job.iso = iso;
+    job.callback = callback;
+    job.hash_flags = hash_flags;
+    job.status = IMN_OK;
 
-        if (cur_dir->id_length == 0) {
-            cur_dir = cur_dir->parent_dir;
-            continue;
-        }
+    atomic_init(&job.next_run, 0);
+    atomic_init(&job.next_ziso, 0);
+    atomic_init(&job.abort, false);
 
-        path_len += cur_dir->id_length + 1;
-        tmp_segment = path_header;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+    pthread_mutex_init(&job.emit_lock, NULL);
 
-        path_header = malloc(sizeof(*path_header));
-        if (path_header == NULL) {
-            ret_val = IMN_ALLOC_ERR;
-            goto exit_linked;
-        }
+    thread_list = NULL;
 
-        path_header->id_length = cur_dir->id_length;
-        path_header->record_id = cur_dir->record_id;
+    collect.fn = collect_file;
+    collect.args = &job;
 
-        path_header->link = tmp_segment;
-        cur_dir = cur_dir->parent_dir;
+    ret_val = imn_traverse_paths(iso, dir_record, &collect, true);
+    if (ret_val != IMN_OK) {
+        if (job.status != IMN_OK) {
+            ret_val = job.status;
+        }
+        goto exit_job;
     }
 
-    if (path_len >= buffer_size) {
-        ret_val = IMN_MEM_ERR;
-        goto exit_linked;
+    ret_val = build_runs(&job);
+    if (ret_val != IMN_OK || job.run_num + job.ziso_num == 0) {
+        goto exit_job;
     }
 
-    // Build full directory path in buffer
-    str_pos = 0;
-    while (path_header != NULL) {
+    if ((size_t) thread_num > job.run_num + job.ziso_num) {
+        thread_num = job.run_num + job.ziso_num;
+    }
 
-        memcpy(buffer + str_pos, path_header->record_id,
-                    path_header->id_length);
+    thread_list = calloc(thread_num, sizeof(*thread_list));
+    if (thread_list == NULL) {
+        ret_val = IMN_ALLOC_ERR;
+        goto exit_job;
+    }
 
-        str_pos += path_header->id_length + 1;
-        buffer[str_pos-1] = '/';
+    for (started_num = 0; started_num < thread_num; started_num++) {
+        if (pthread_create(&thread_list[started_num], NULL, hash_main,
+                            &job) != 0) {
+            fail_hash(&job, IMN_THREAD_ERR);
+            break;
+        }
+    }
 
-        tmp_segment = path_header;
-        path_header = path_header->link;
-        free(tmp_segment);
+    for (worker_idx = 0; worker_idx < started_num; worker_idx++) {
+        pthread_join(thread_list[worker_idx], NULL);
     }
-    buffer[str_pos-1] = '\0';
 
-    ret_val = IMN_OK;
-    goto exit_normal;
+    ret_val = job.status;
 
-    exit_linked:
-        free_path_list(path_header);
+    exit_job:
+        for (ziso_idx = 0; ziso_idx < job.ziso_num; ziso_idx++) {
+            imn_free_record(&job.ziso_list[ziso_idx].record);
+        }
+        free(job.ziso_list);
+        free(thread_list);
+        free(job.scratch);
+        free(job.run_list);
+        free(job.seg_list);
+        free(job.path_pool);
+        free(job.file_list);
+
+        pthread_mutex_destroy(&job.emit_lock);
+        pthread_cond_destroy(&job.cond);
+        pthread_mutex_destroy(&job.lock);
     exit_normal:
         return ret_val;
 }
@@ -0,0 +1,462 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "iso.h"
+#include "gen.h"
+
+#define GEN_SAMPLE_MAX 4096
+#define BENCH_READ_CHUNK 0x10000
+
+// Linked with -Wl,--wrap so every pread/syscall/allocation is counted
+typedef struct {
+    uint64_t syscalls;
+    uint64_t allocs;
+} bench_count_t;
+
+static bench_count_t counts;
+
+ssize_t __real_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t __real_pread64(int fd, void *buf, size_t count, off_t offset);
+long __real_syscall(long number, long a1, long a2, long a3, long a4,
+        long a5, long a6);
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+ssize_t __wrap_pread(int fd, void *buf, size_t count, off_t offset) {
+    counts.syscalls++;
+    return __real_pread(fd, buf, count, offset);
+}
+
+// The library is built with 64-bit off_t, which glibc maps onto pread64
+ssize_t __wrap_pread64(int fd, void *buf, size_t count, off_t offset) {
+    counts.syscalls++;
+    return __real_pread64(fd, buf, count, offset);
+}
+
+// Only reached by the io_uring backend; its calls take at most six args
+long __wrap_syscall(long number, long a1, long a2, long a3, long a4,
+        long a5, long a6) {
+    counts.syscalls++;
+    return __real_syscall(number, a1, a2, a3, a4, a5, a6);
+}
+
+void *__wrap_malloc(size_t size) {
+    counts.allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+    counts.allocs++;
+    return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    counts.allocs++;
+    return __real_realloc(ptr, size);
+}
+
+/**** Image shapes ****/
+
+static gen_shape_t shape_list[] = {
+    // name      depth dirs files  size      extent   long   prefix rr     ziso
+    {"deep",     128,  1,   16,    512,      0,       false, false, false, false},
+    {"flat",     0,    0,   100000, 0,       0,       false, false, false, false},
+    {"tree",     4,    6,   32,    256,      0,       false, false, false, false},
+    {"multi",    0,    0,   16,    0x400000, 0x40000, false, false, false, false},
+    {"long",     3,    4,   200,   64,       0,       true,  false, false, false},
+    {"prefix",   0,    0,   4000,  0,        0,       false, true,  false, false},
+    {"rr",       2,    4,   48,    128,      0,       false, false, true,  false},
+};
+
+/**** Benchmarks ****/
+
+typedef struct {
+    imn_iso_t *iso;
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t seen;
+
+    char **sample_list;
+    uint32_t sample_num;
+
+    uint8_t *read_buf;
+    imn_error_t error;
+} bench_state_t;
+
+typedef struct {
+    struct timespec start;
+    bench_count_t counts;
+} bench_mark_t;
+
+static
+void mark_start(bench_mark_t *mark) {
+    mark->counts = counts;
+    clock_gettime(CLOCK_MONOTONIC, &mark->start);
+}
+
+static
+void mark_report(bench_mark_t *mark, char *shape, char *phase,
+        uint64_t ops, uint64_t bytes) {
+
+    struct timespec end;
+    double secs, per_op;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - mark->start.tv_sec) +
+            (end.tv_nsec - mark->start.tv_nsec) / 1e9;
+    per_op = ops ? 1.0 / ops : 0;
+
+    printf("%-6s %-9s %9lu %9.4f %12.0f %10.1f %10.3f %10.3f\n",
+            shape, phase, (unsigned long) ops, secs,
+            secs > 0 ? ops / secs : 0,
+            secs > 0 ? bytes / secs / 1e6 : 0,
+            (counts.syscalls - mark->counts.syscalls) * per_op,
+            (counts.allocs - mark->counts.allocs) * per_op);
+}
+
+static
+int count_cb(imn_record_t *rec, void *args) {
+
+    bench_state_t *state;
+
+    state = args;
+    state->ops++;
+    state->bytes += rec->total_size;
+    return 0;
+}
+
+static
+int path_cb(imn_record_t *rec, void *args) {
+
+    bench_state_t *state;
+    char path[0x1000];
+
+    state = args;
+    if (imn_get_path(rec, path, sizeof(path)) != IMN_OK) {
+        return -1;
+    }
+    state->ops++;
+    state->bytes += strlen(path);
+    return 0;
+}
+
+static
+int running_cb(imn_record_t *rec, char *path, size_t path_len, void *args) {
+
+    bench_state_t *state;
+
+    state = args;
+    state->ops++;
+    state->bytes += path_len;
+    return (rec != NULL && path != NULL) ? 0 : -1;
+}
+
+// Keeps an evenly spread subset of paths for the lookup phase
+static
+int sample_cb(imn_record_t *rec, void *args) {
+
+    bench_state_t *state;
+    char path[0x1000];
+    uint64_t stride;
+
+    state = args;
+    stride = state->ops / GEN_SAMPLE_MAX + 1;
+
+    if (state->seen++ % stride == 0 && state->sample_num < GEN_SAMPLE_MAX) {
+        if (imn_get_path(rec, path, sizeof(path)) != IMN_OK) {
+            return -1;
+        }
+        state->sample_list[state->sample_num] = strdup(path);
+        if (state->sample_list[state->sample_num] == NULL) {
+            return -1;
+        }
+        state->sample_num++;
+    }
+    return 0;
+}
+
+static
+int read_cb(imn_record_t *rec, void *args) {
+
+    bench_state_t *state;
+    imn_file_t file;
+    size_t read_len;
+
+    state = args;
+    if (rec->is_dir) {
+        return 0;
+    }
+
+    state->error = imn_open(state->iso, rec, &file);
+    if (state->error != IMN_OK) {
+        return -1;
+    }
+
+    do {
+        state->error = imn_read(&file, state->read_buf, BENCH_READ_CHUNK,
+                                &read_len);
+        state->bytes += read_len;
+    } while (state->error == IMN_OK && read_len > 0);
+
+    imn_close_file(&file);
+    state->ops++;
+    return (state->error == IMN_OK) ? 0 : -1;
+}
+
+// Rebuilds the generator's attributes from the record's name and checks
+// that imn_get_rr, following CE where needed, returns the same ones
+static
+int rr_cb(imn_record_t *rec, void *args) {
+
+    bench_state_t *state;
+    imn_rr_attr_t attr;
+    gen_node_t node;
+    char id[GEN_NAME_MAX], name[GEN_NAME_MAX], link[GEN_NAME_MAX + 3];
+    uint32_t px[5], name_len, link_len;
+    bool is_ok;
+
+    state = args;
+    if (rec->id_length == 0 || rec->id_length >= sizeof(id)) {
+        state->error = IMN_STD_ERR;
+        return -1;
+    }
+
+    // PVD names may point into the directory data, unterminated
+    memcpy(id, rec->record_id, rec->id_length);
+    id[rec->id_length] = '\0';
+
+    memset(&node, 0, sizeof(node));
+    node.is_dir = rec->is_dir;
+    node.seq = strtoul(id + 1, NULL, 10);
+
+    state->error = imn_get_rr(state->iso, rec, &attr);
+    if (state->error != IMN_OK) {
+        return -1;
+    }
+
+    rr_px(&node, px);
+    name_len = rr_name(&node, name);
+    link_len = 0;
+    if (rr_is_link(&node)) {
+        memcpy(link, "../", 3);
+        link_len = 3 + rr_link(&node, link + 3);
+    }
+
+    is_ok = attr.has_px && attr.mode == px[0] && attr.nlink == px[1] &&
+            attr.uid == px[2] && attr.gid == px[3] && attr.ino == px[4] &&
+            attr.name_length == name_len &&
+            memcmp(attr.name, name, name_len) == 0 &&
+            attr.link_length == link_len &&
+            (link_len == 0 || memcmp(attr.link_target, link, link_len) == 0);
+
+    imn_free_rr(&attr);
+    if (!is_ok) {
+        fprintf(stderr, "rr: attributes of %s do not match\n", id);
+        state->error = IMN_STD_ERR;
+        return -1;
+    }
+
+    state->ops++;
+    return 0;
+}
+
+static
+bool run_shape(gen_shape_t *shape, char *path, bool use_mmap) {
+
+    imn_iso_t iso;
+    imn_callback_t cb;
+    imn_path_callback_t path_cb_info;
+    imn_record_t record;
+    bench_state_t state;
+    bench_mark_t mark;
+    imn_error_t ret_val;
+    uint32_t sample_idx;
+    char miss_path[0x1000];
+    bool is_ok;
+
+    is_ok = false;
+    memset(&state, 0, sizeof(state));
+
+    if (!gen_image(shape, path)) {
+        fprintf(stderr, "%s: could not write %s\n", shape->name, path);
+        return false;
+    }
+
+    mark_start(&mark);
+    ret_val = use_mmap ? imn_init_mmap(&iso, path, true)
+                       : imn_init(&iso, path, true);
+    if (ret_val != IMN_OK) {
+        fprintf(stderr, "%s: init failed (%d)\n", shape->name, ret_val);
+        return false;
+    }
+    mark_report(&mark, shape->name, "init", 1, 0);
+
+    state.iso = &iso;
+    state.sample_list = calloc(GEN_SAMPLE_MAX, sizeof(*state.sample_list));
+    state.read_buf = malloc(BENCH_READ_CHUNK);
+    if (state.sample_list == NULL || state.read_buf == NULL) {
+        goto exit_iso;
+    }
+
+    cb.fn = count_cb;
+    cb.args = &state;
+    mark_start(&mark);
+    ret_val = imn_traverse_dir(&iso, iso.desc->root_dir, &cb, true);
+    if (ret_val != IMN_OK) {
+        goto exit_iso;
+    }
+    mark_report(&mark, shape->name, "traverse", state.ops, 0);
+
+    if (shape->rock_ridge) {
+
+        state.ops = 0;
+        cb.fn = rr_cb;
+        mark_start(&mark);
+        ret_val = imn_traverse_dir(&iso, iso.desc->root_dir, &cb, true);
+        if (ret_val != IMN_OK) {
+            if (state.error != IMN_OK) {
+                ret_val = state.error;
+            }
+            goto exit_iso;
+        }
+        mark_report(&mark, shape->name, "rr", state.ops, 0);
+
+        // Traversal counts entries for the sampling stride below
+        state.ops = 0;
+        cb.fn = count_cb;
+        ret_val = imn_traverse_dir(&iso, iso.desc->root_dir, &cb, true);
+        if (ret_val != IMN_OK) {
+            goto exit_iso;
+        }
+    }
+
+    // Untimed pass; ops still holds the entry count for the stride
+    cb.fn = sample_cb;
+    ret_val = imn_traverse_dir(&iso, iso.desc->root_dir, &cb, true);
+    if (ret_val != IMN_OK) {
+        goto exit_iso;
+    }
+
+    state.ops = 0;
+    state.bytes = 0;
+    cb.fn = path_cb;
+    mark_start(&mark);
+    ret_val = imn_traverse_dir(&iso, iso.desc->root_dir, &cb, true);
+    if (ret_val != IMN_OK) {
+        goto exit_iso;
+    }
+    mark_report(&mark, shape->name, "get_path", state.ops, 0);
+
+    state.ops = 0;
+    path_cb_info.fn = running_cb;
+    path_cb_info.args = &state;
+    mark_start(&mark);
+    ret_val = imn_traverse_paths(&iso, iso.desc->root_dir, &path_cb_info,
+                                    true);
+    if (ret_val != IMN_OK) {
+        goto exit_iso;
+    }
+    mark_report(&mark, shape->name, "paths", state.ops, 0);
+
+    mark_start(&mark);
+    for (sample_idx = 0; sample_idx < state.sample_num; sample_idx++) {
+        ret_val = imn_lookup(&iso, state.sample_list[sample_idx], &record);
+        if (ret_val != IMN_OK) {
+            fprintf(stderr, "%s: lookup of %s failed (%d)\n", shape->name,
+                    state.sample_list[sample_idx], ret_val);
+            goto exit_iso;
+        }
+        imn_free_record(&record);
+    }
+    mark_report(&mark, shape->name, "lookup", state.sample_num, 0);
+
+    // Names that sort after a real one; a sorted directory must not be
+    // rescanned to prove they are missing
+    mark_start(&mark);
+    for (sample_idx = 0; sample_idx < state.sample_num; sample_idx++) {
+        snprintf(miss_path, sizeof(miss_path), "%sx",
+                    state.sample_list[sample_idx]);
+        ret_val = imn_lookup(&iso, miss_path, &record);
+        if (ret_val != IMN_PATH_ERR) {
+            if (ret_val == IMN_OK) {
+                imn_free_record(&record);
+            }
+            fprintf(stderr, "%s: lookup of %s did not miss (%d)\n",
+                    shape->name, miss_path, ret_val);
+            goto exit_iso;
+        }
+    }
+    ret_val = IMN_OK;
+    mark_report(&mark, shape->name, "miss", state.sample_num, 0);
+
+    state.ops = 0;
+    state.bytes = 0;
+    cb.fn = read_cb;
+    mark_start(&mark);
+    ret_val = imn_traverse_dir(&iso, iso.desc->root_dir, &cb, true);
+    if (ret_val != IMN_OK) {
+        goto exit_iso;
+    }
+    mark_report(&mark, shape->name, "read", state.ops, state.bytes);
+
+    is_ok = true;
+    exit_iso:
+        if (!is_ok && ret_val != IMN_OK) {
+            fprintf(stderr, "%s: failed (%d)\n", shape->name, ret_val);
+        }
+        for (sample_idx = 0; sample_idx < state.sample_num; sample_idx++) {
+            free(state.sample_list[sample_idx]);
+        }
+        free(state.sample_list);
+        free(state.read_buf);
+        imn_close(&iso);
+        return is_ok;
+}
+
+int main(int argc, char *argv[]) {
+
+    char path[] = "/tmp/iso_bench_XXXXXX";
+    size_t shape_idx;
+    int arg_idx, fd;
+    bool use_mmap, is_picked, is_ok;
+
+    use_mmap = (argc > 1 && strcmp(argv[1], "-m") == 0);
+    arg_idx = use_mmap ? 2 : 1;
+
+    fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    printf("%-6s %-9s %9s %9s %12s %10s %10s %10s\n", "shape", "phase",
+            "ops", "secs", "ops/s", "MB/s", "sys/op", "alloc/op");
+
+    is_ok = true;
+    for (shape_idx = 0; shape_idx < sizeof(shape_list) /
+                                    sizeof(shape_list[0]); shape_idx++) {
+
+        // No names selects every shape
+        is_picked = (arg_idx == argc);
+        for (fd = arg_idx; fd < argc; fd++) {
+            if (strcmp(argv[fd], shape_list[shape_idx].name) == 0) {
+                is_picked = true;
+            }
+        }
+
+        if (is_picked && !run_shape(&shape_list[shape_idx], path, use_mmap)) {
+            is_ok = false;
+        }
+    }
+
+    unlink(path);
+    return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
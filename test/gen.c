@@ -0,0 +1,852 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "iso.h"
+#include "gen.h"
+
+#define GEN_FILL_CHUNK 0x100000
+
+// SP and PX on the root's "." record, padded to an even length
+#define GEN_ROOT_SUSP (7 + 44 + 1)
+
+/**** Synthetic Joliet and Rock Ridge images ****/
+
+typedef struct {
+    gen_shape_t *shape;
+
+    gen_node_t *node_list;
+    uint32_t node_num;
+    uint32_t node_cap;
+    uint32_t dir_num;
+
+    uint32_t pt_size;
+    uint32_t pt_lba;
+    uint32_t total_lba;
+
+    // zisofs shapes only: the one stream every file is stored as
+    uint8_t *ziso_data;
+    uint32_t ziso_len;
+} gen_image_t;
+
+void gen_fill(uint8_t *dst, uint64_t offset, size_t length) {
+
+    size_t pos;
+
+    for (pos = 0; pos < length; pos++) {
+        dst[pos] = (offset + pos) * 131 + 7;
+    }
+}
+
+static
+void put_both16(uint8_t *dst, uint16_t val) {
+    dst[0] = val; dst[1] = val >> 8;
+    dst[2] = val >> 8; dst[3] = val;
+}
+
+static
+void put_both32(uint8_t *dst, uint32_t val) {
+    dst[0] = val; dst[1] = val >> 8; dst[2] = val >> 16; dst[3] = val >> 24;
+    dst[4] = val >> 24; dst[5] = val >> 16; dst[6] = val >> 8; dst[7] = val;
+}
+
+static
+void put_le32(uint8_t *dst, uint32_t val) {
+    dst[0] = val; dst[1] = val >> 8; dst[2] = val >> 16; dst[3] = val >> 24;
+}
+
+static
+void put_be32(uint8_t *dst, uint32_t val) {
+    dst[0] = val >> 24; dst[1] = val >> 16; dst[2] = val >> 8; dst[3] = val;
+}
+
+static
+void make_name(gen_node_t *node, char kind, uint32_t seq,
+        gen_shape_t *shape) {
+
+    char prefix[16];
+    int prefix_len, pos;
+
+    // Zero-padded counters keep generation order equal to sorted order;
+    // prefix names pair "f000000" with "f0000001", which collates between
+    // it and "f000001" only when names are padded with 0x20
+    if (shape->prefix_names && kind == 'f') {
+        prefix_len = snprintf(prefix, sizeof(prefix),
+                                (seq & 1) ? "%c%06u1" : "%c%06u", kind,
+                                seq / 2);
+    } else {
+        prefix_len = snprintf(prefix, sizeof(prefix), "%c%06u", kind, seq);
+    }
+    for (pos = 0; pos < prefix_len; pos++) {
+        node->name[pos] = (uint8_t) prefix[pos];
+    }
+
+    // Rock Ridge trees sit under the PVD, where d-characters are upper case
+    if (shape->rock_ridge) {
+        node->name[0] = kind - 'a' + 'A';
+    }
+    node->seq = seq;
+
+    // Alternate Greek and CJK so names need the full UTF-8 path
+    if (shape->long_names) {
+        for (; pos < GEN_NAME_MAX - 2; pos++) {
+            node->name[pos] = (pos & 1) ? 0x03BB : 0x4E2D;
+        }
+    }
+
+    if (kind == 'f') {
+        node->name[pos++] = ';';
+        node->name[pos++] = '1';
+    }
+
+    node->name_len = pos;
+}
+
+static
+gen_node_t *gen_add(gen_image_t *img, uint32_t parent, bool is_dir) {
+
+    gen_node_t *node, *new_list;
+
+    if (img->node_num == img->node_cap) {
+        img->node_cap = img->node_cap ? img->node_cap * 2 : 1024;
+        new_list = realloc(img->node_list,
+                            img->node_cap * sizeof(*new_list));
+        if (new_list == NULL) {
+            return NULL;
+        }
+        img->node_list = new_list;
+    }
+
+    node = &img->node_list[img->node_num++];
+    memset(node, 0, sizeof(*node));
+    node->parent = parent;
+    node->is_dir = is_dir;
+
+    if (is_dir) {
+        node->dir_num = ++img->dir_num;
+    }
+
+    return node;
+}
+
+static
+uint32_t extent_num(gen_image_t *img, gen_node_t *node) {
+
+    if (node->is_dir || img->shape->extent_size == 0 || node->size == 0) {
+        return 1;
+    }
+    return (node->size + img->shape->extent_size - 1) /
+            img->shape->extent_size;
+}
+
+static
+uint32_t record_len(uint8_t id_len) {
+    return 33 + id_len + ((id_len & 1) ? 0 : 1);
+}
+
+// Bytes a file takes on disk; zisofs files are stored compressed
+static
+uint64_t data_len(gen_image_t *img, gen_node_t *node) {
+    return (img->shape->zisofs && node->size) ? img->ziso_len : node->size;
+}
+
+// Joliet names are UCS-2; Rock Ridge images use the PVD's d-characters
+static
+uint8_t name_size(gen_image_t *img, gen_node_t *node) {
+    return node->name_len * (img->shape->rock_ridge ? 1 : 2);
+}
+
+// Files numbered 3 mod 4 are symlinks, and odd entries keep NM/SL in a CE
+// area
+
+bool rr_is_link(gen_node_t *node) {
+    return !node->is_dir && node->seq % 4 == 3;
+}
+
+static
+bool rr_has_ce(gen_node_t *node) {
+    return node->seq & 1;
+}
+
+uint32_t rr_name(gen_node_t *node, char *dst) {
+    return snprintf(dst, GEN_NAME_MAX, "%s-%06u.rock-ridge",
+                    node->is_dir ? "directory" : "file", node->seq);
+}
+
+uint32_t rr_link(gen_node_t *node, char *dst) {
+    return snprintf(dst, GEN_NAME_MAX, "target-%06u", node->seq);
+}
+
+// mode, nlink, uid, gid and serial number, in PX order
+void rr_px(gen_node_t *node, uint32_t *px) {
+
+    if (node->is_dir) {
+        px[0] = S_IFDIR | 0755;
+    } else if (rr_is_link(node)) {
+        px[0] = S_IFLNK | 0777;
+    } else {
+        px[0] = S_IFREG | 0644;
+    }
+    px[1] = node->is_dir ? 2 : 1;
+    px[2] = 1000 + node->seq % 7;
+    px[3] = 100 + node->seq % 5;
+    px[4] = node->seq + 2;
+}
+
+// NM plus, for symlinks, an SL of ".." and the target
+static
+uint32_t rr_text_len(gen_node_t *node) {
+
+    char text[GEN_NAME_MAX];
+    uint32_t len;
+
+    len = 5 + rr_name(node, text);
+    if (rr_is_link(node)) {
+        len += 5 + 2 + 2 + rr_link(node, text);
+    }
+    return len;
+}
+
+// System Use bytes inside the directory record, padded to keep it even
+static
+uint32_t rr_susp_len(gen_node_t *node) {
+
+    uint32_t len;
+
+    len = 44 + (rr_has_ce(node) ? 28 : rr_text_len(node));
+    return len + (len & 1);
+}
+
+static
+uint32_t entry_len(gen_image_t *img, gen_node_t *node) {
+
+    uint32_t len;
+
+    len = record_len(name_size(img, node));
+    if (img->shape->rock_ridge) {
+        len += rr_susp_len(node);
+    }
+    return len;
+}
+
+// Nodes are generated breadth-first, so siblings are contiguous
+static
+bool gen_tree(gen_image_t *img) {
+
+    gen_shape_t *shape;
+    gen_node_t *node;
+    uint32_t node_idx, child_idx, seq;
+
+    shape = img->shape;
+    seq = 0;
+
+    node = gen_add(img, 0, true);
+    if (node == NULL) {
+        return false;
+    }
+    node->name_len = 1;
+
+    for (node_idx = 0; node_idx < img->node_num; node_idx++) {
+
+        if (!img->node_list[node_idx].is_dir) {
+            continue;
+        }
+
+        img->node_list[node_idx].first_child = img->node_num;
+
+        if (img->node_list[node_idx].depth < shape->depth) {
+            for (child_idx = 0; child_idx < shape->dirs_per_dir; child_idx++) {
+                node = gen_add(img, node_idx, true);
+                if (node == NULL) {
+                    return false;
+                }
+                node->depth = img->node_list[node_idx].depth + 1;
+                make_name(node, 'd', seq++, shape);
+            }
+        }
+
+        for (child_idx = 0; child_idx < shape->files_per_dir; child_idx++) {
+            node = gen_add(img, node_idx, false);
+            if (node == NULL) {
+                return false;
+            }
+            make_name(node, 'f', seq++, shape);
+            node->size = (shape->rock_ridge && rr_is_link(node)) ?
+                            0 : shape->file_size;
+        }
+
+        img->node_list[node_idx].child_num =
+            img->node_num - img->node_list[node_idx].first_child;
+    }
+
+    return true;
+}
+
+static
+void gen_layout(gen_image_t *img) {
+
+    gen_node_t *node, *child;
+    uint32_t node_idx, child_idx, ext_idx, pos, rec_len, lba, ce_pos;
+
+    // 16 PVD, 17 Joliet SVD, 18 terminator, 19 PVD root, 20/21 PVD tables;
+    // Rock Ridge images leave 17 and 19-21 unused
+    lba = 22;
+
+    img->pt_size = 0;
+    for (node_idx = 0; node_idx < img->node_num; node_idx++) {
+        node = &img->node_list[node_idx];
+        if (node->is_dir) {
+            img->pt_size += 8 + (node_idx ? name_size(img, node) : 1);
+            img->pt_size += img->pt_size & 1;
+        }
+    }
+    img->pt_lba = lba;
+    lba += 2 * ((img->pt_size + GEN_SECTOR - 1) / GEN_SECTOR);
+
+    for (node_idx = 0; node_idx < img->node_num; node_idx++) {
+
+        node = &img->node_list[node_idx];
+        if (!node->is_dir) {
+            continue;
+        }
+
+        // "." and "..", then one record per child extent
+        pos = 2 * record_len(1);
+        if (img->shape->rock_ridge && node_idx == 0) {
+            pos += GEN_ROOT_SUSP;
+        }
+
+        ce_pos = 0;
+        for (child_idx = 0; child_idx < node->child_num; child_idx++) {
+
+            child = &img->node_list[node->first_child + child_idx];
+            rec_len = entry_len(img, child);
+
+            for (ext_idx = 0; ext_idx < extent_num(img, child); ext_idx++) {
+                if (pos % GEN_SECTOR + rec_len > GEN_SECTOR) {
+                    pos += GEN_SECTOR - pos % GEN_SECTOR;
+                }
+                pos += rec_len;
+            }
+
+            // Continuation areas may not cross a sector either
+            if (img->shape->rock_ridge && rr_has_ce(child)) {
+                rec_len = rr_text_len(child);
+                if (ce_pos % GEN_SECTOR + rec_len > GEN_SECTOR) {
+                    ce_pos += GEN_SECTOR - ce_pos % GEN_SECTOR;
+                }
+                child->ce_pos = ce_pos;
+                ce_pos += rec_len;
+            }
+        }
+
+        // A directory's continuation sectors follow its extent
+        node->dir_size = (pos + GEN_SECTOR - 1) / GEN_SECTOR * GEN_SECTOR;
+        node->ce_size = (ce_pos + GEN_SECTOR - 1) / GEN_SECTOR * GEN_SECTOR;
+        node->lba = lba;
+        lba += (node->dir_size + node->ce_size) / GEN_SECTOR;
+    }
+
+    for (node_idx = 0; node_idx < img->node_num; node_idx++) {
+
+        node = &img->node_list[node_idx];
+        if (node->is_dir || node->size == 0) {
+            continue;
+        }
+
+        node->lba = lba;
+        lba += (data_len(img, node) + GEN_SECTOR - 1) / GEN_SECTOR;
+    }
+
+    img->total_lba = lba;
+}
+
+static
+uint32_t put_record(uint8_t *dst, uint32_t lba, uint32_t size, bool is_dir,
+        bool is_more, uint16_t *name, uint8_t name_len, uint8_t char_size) {
+
+    uint32_t rec_len, pos;
+
+    rec_len = record_len(name ? name_len * char_size : 1);
+    memset(dst, 0, rec_len);
+
+    dst[0] = rec_len;
+    put_both32(dst + 2, lba);
+    put_both32(dst + 10, size);
+    dst[18] = 120; dst[19] = 1; dst[20] = 1;
+    dst[25] = (is_dir ? 0x02 : 0) | (is_more ? 0x80 : 0);
+    put_both16(dst + 28, 1);
+
+    if (name == NULL) {
+        dst[32] = 1;
+        dst[33] = name_len;
+    } else if (char_size == 1) {
+        dst[32] = name_len;
+        for (pos = 0; pos < name_len; pos++) {
+            dst[33 + pos] = name[pos];
+        }
+    } else {
+        dst[32] = name_len * 2;
+        for (pos = 0; pos < name_len; pos++) {
+            dst[33 + pos * 2] = name[pos] >> 8;
+            dst[34 + pos * 2] = name[pos];
+        }
+    }
+
+    return rec_len;
+}
+
+static
+uint32_t put_px(uint8_t *dst, uint32_t *px) {
+
+    uint32_t field;
+
+    memcpy(dst, "PX", 2);
+    dst[2] = 44;
+    dst[3] = 1;
+    for (field = 0; field < 5; field++) {
+        put_both32(dst + 4 + field * 8, px[field]);
+    }
+    return 44;
+}
+
+static
+uint32_t put_rr_text(uint8_t *dst, gen_node_t *node) {
+
+    char text[GEN_NAME_MAX];
+    uint32_t len, pos;
+
+    len = rr_name(node, text);
+    memcpy(dst, "NM", 2);
+    dst[2] = 5 + len;
+    dst[3] = 1;
+    dst[4] = 0;
+    memcpy(dst + 5, text, len);
+    pos = 5 + len;
+
+    if (!rr_is_link(node)) {
+        return pos;
+    }
+
+    // One ".." component, then the target's name
+    len = rr_link(node, text);
+    memcpy(dst + pos, "SL", 2);
+    dst[pos + 2] = 5 + 2 + 2 + len;
+    dst[pos + 3] = 1;
+    dst[pos + 4] = 0;
+    dst[pos + 5] = 0x04;
+    dst[pos + 6] = 0;
+    dst[pos + 7] = 0;
+    dst[pos + 8] = len;
+    memcpy(dst + pos + 9, text, len);
+
+    return pos + 9 + len;
+}
+
+// Appends the entry's System Use area to the record at dst
+static
+void put_susp(uint8_t *dst, gen_node_t *node, uint32_t ce_lba) {
+
+    uint8_t *area;
+    uint32_t px[5];
+    uint32_t pos;
+
+    area = dst + dst[0];
+    rr_px(node, px);
+    pos = put_px(area, px);
+
+    if (rr_has_ce(node)) {
+        memcpy(area + pos, "CE", 2);
+        area[pos + 2] = 28;
+        area[pos + 3] = 1;
+        put_both32(area + pos + 4, ce_lba + node->ce_pos / GEN_SECTOR);
+        put_both32(area + pos + 12, node->ce_pos % GEN_SECTOR);
+        put_both32(area + pos + 20, rr_text_len(node));
+    } else {
+        put_rr_text(area + pos, node);
+    }
+
+    dst[0] += rr_susp_len(node);
+}
+
+static
+void put_desc(uint8_t *dst, uint8_t type, gen_image_t *img, uint32_t root_lba,
+        uint32_t root_size, uint32_t pt_size, uint32_t pt_lba) {
+
+    memset(dst, 0, GEN_SECTOR);
+    dst[0] = type;
+    memcpy(dst + 1, "CD001", 5);
+    dst[6] = 1;
+    memset(dst + 8, ' ', 64);
+    memcpy(dst + 40, "BENCH", 5);
+    put_both32(dst + 80, img->total_lba);
+
+    if (type == DESC_TYPE_SUPPLEMENTARY) {
+        memcpy(dst + 88, "%/E", 3);
+    }
+
+    put_both16(dst + 120, 1);
+    put_both16(dst + 124, 1);
+    put_both16(dst + 128, GEN_SECTOR);
+    put_both32(dst + 132, pt_size);
+    put_le32(dst + 140, pt_lba);
+    put_be32(dst + 148, pt_lba + (pt_size + GEN_SECTOR - 1) / GEN_SECTOR);
+    put_record(dst + 156, root_lba, root_size, true, false, NULL, 0, 1);
+    dst[881] = 1;
+}
+
+static
+bool write_at(int fd, void *data, size_t length, off_t offset) {
+
+    uint8_t *src;
+    ssize_t write_ret;
+
+    src = data;
+    while (length > 0) {
+        write_ret = pwrite(fd, src, length, offset);
+        if (write_ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (write_ret <= 0) {
+            return false;
+        }
+        src += write_ret;
+        offset += write_ret;
+        length -= write_ret;
+    }
+
+    return true;
+}
+
+static
+bool gen_write(gen_image_t *img, int fd) {
+
+    uint8_t sector[GEN_SECTOR];
+    uint8_t *dir_data, *pt_data, *fill;
+    uint32_t px[5];
+    gen_node_t *node, *child;
+    uint32_t node_idx, child_idx, ext_idx, ext_num, pos, rec_len, pt_pos;
+    uint64_t remain, chunk, offset;
+    uint8_t char_size;
+    bool is_ok, is_rr;
+
+    is_ok = false;
+    is_rr = img->shape->rock_ridge;
+    char_size = is_rr ? 1 : 2;
+    dir_data = NULL;
+    fill = NULL;
+    pt_data = calloc(2, (img->pt_size + GEN_SECTOR - 1) / GEN_SECTOR *
+                        GEN_SECTOR);
+    if (pt_data == NULL || ftruncate(fd, (off_t) img->total_lba *
+                                            GEN_SECTOR) == -1) {
+        goto exit_normal;
+    }
+
+    // Plain PVD with an empty root; the Joliet SVD carries the tree.
+    // Rock Ridge images hang the tree off the PVD and have no SVD
+    if (is_rr) {
+        put_desc(sector, DESC_TYPE_PRIMARY, img, img->node_list[0].lba,
+                    img->node_list[0].dir_size, img->pt_size, img->pt_lba);
+    } else {
+        put_desc(sector, DESC_TYPE_PRIMARY, img, 19, GEN_SECTOR, 10, 20);
+    }
+    if (!write_at(fd, sector, GEN_SECTOR, 16 * GEN_SECTOR)) {
+        goto exit_normal;
+    }
+
+    if (!is_rr) {
+        put_desc(sector, DESC_TYPE_SUPPLEMENTARY, img, img->node_list[0].lba,
+                    img->node_list[0].dir_size, img->pt_size, img->pt_lba);
+        if (!write_at(fd, sector, GEN_SECTOR, 17 * GEN_SECTOR)) {
+            goto exit_normal;
+        }
+    }
+
+    memset(sector, 0, GEN_SECTOR);
+    sector[0] = DESC_TYPE_TERMINATOR;
+    memcpy(sector + 1, "CD001", 5);
+    sector[6] = 1;
+    if (!write_at(fd, sector, GEN_SECTOR, (is_rr ? 17 : 18) * GEN_SECTOR)) {
+        goto exit_normal;
+    }
+
+    if (!is_rr) {
+
+        memset(sector, 0, GEN_SECTOR);
+        pos = put_record(sector, 19, GEN_SECTOR, true, false, NULL, 0, 1);
+        put_record(sector + pos, 19, GEN_SECTOR, true, false, NULL, 1, 1);
+        if (!write_at(fd, sector, GEN_SECTOR, 19 * GEN_SECTOR)) {
+            goto exit_normal;
+        }
+
+        memset(sector, 0, GEN_SECTOR);
+        sector[0] = 1;
+        put_le32(sector + 2, 19);
+        sector[6] = 1;
+        if (!write_at(fd, sector, GEN_SECTOR, 20 * GEN_SECTOR)) {
+            goto exit_normal;
+        }
+        put_be32(sector + 2, 19);
+        sector[6] = 0;
+        sector[7] = 1;
+        if (!write_at(fd, sector, GEN_SECTOR, 21 * GEN_SECTOR)) {
+            goto exit_normal;
+        }
+    }
+
+    // L and M path tables, built side by side
+    pt_pos = 0;
+    for (node_idx = 0; node_idx < img->node_num; node_idx++) {
+
+        node = &img->node_list[node_idx];
+        if (!node->is_dir) {
+            continue;
+        }
+
+        child = &img->node_list[node->parent];
+        rec_len = node_idx ? name_size(img, node) : 1;
+        pt_data[pt_pos] = rec_len;
+        put_le32(pt_data + pt_pos + 2, node->lba);
+        pt_data[pt_pos + 6] = child->dir_num;
+        pt_data[pt_pos + 7] = child->dir_num >> 8;
+
+        for (pos = 0; node_idx && pos < node->name_len; pos++) {
+            if (is_rr) {
+                pt_data[pt_pos + 8 + pos] = node->name[pos];
+            } else {
+                pt_data[pt_pos + 8 + pos * 2] = node->name[pos] >> 8;
+                pt_data[pt_pos + 9 + pos * 2] = node->name[pos];
+            }
+        }
+
+        pt_pos += 8 + rec_len + (rec_len & 1);
+    }
+
+    memcpy(pt_data + img->pt_size, pt_data, img->pt_size);
+    for (pt_pos = img->pt_size; pt_pos < 2 * img->pt_size;
+            pt_pos += 8 + rec_len + (rec_len & 1)) {
+
+        rec_len = pt_data[pt_pos];
+        put_be32(pt_data + pt_pos + 2, pt_data[pt_pos + 2] |
+                    pt_data[pt_pos + 3] << 8 | pt_data[pt_pos + 4] << 16 |
+                    (uint32_t) pt_data[pt_pos + 5] << 24);
+        child_idx = pt_data[pt_pos + 6];
+        pt_data[pt_pos + 6] = pt_data[pt_pos + 7];
+        pt_data[pt_pos + 7] = child_idx;
+    }
+
+    if (!write_at(fd, pt_data, img->pt_size,
+                    (off_t) img->pt_lba * GEN_SECTOR) ||
+            !write_at(fd, pt_data + img->pt_size, img->pt_size,
+                    ((off_t) img->pt_lba + (img->pt_size + GEN_SECTOR - 1) /
+                        GEN_SECTOR) * GEN_SECTOR)) {
+        goto exit_normal;
+    }
+
+    for (node_idx = 0; node_idx < img->node_num; node_idx++) {
+
+        node = &img->node_list[node_idx];
+        if (!node->is_dir) {
+            continue;
+        }
+
+        dir_data = calloc(1, node->dir_size + node->ce_size);
+        if (dir_data == NULL) {
+            goto exit_normal;
+        }
+
+        child = &img->node_list[node->parent];
+        pos = put_record(dir_data, node->lba, node->dir_size, true, false,
+                            NULL, 0, char_size);
+
+        // SP must open the root's "." System Use area
+        if (is_rr && node_idx == 0) {
+            memcpy(dir_data + pos, "SP\x07\x01\xBE\xEF\x00", 7);
+            rr_px(node, px);
+            px[2] = 0;
+            px[3] = 0;
+            px[4] = 1;
+            put_px(dir_data + pos + 7, px);
+            dir_data[0] += GEN_ROOT_SUSP;
+            pos += GEN_ROOT_SUSP;
+        }
+
+        pos += put_record(dir_data + pos, child->lba, child->dir_size, true,
+                            false, NULL, 1, char_size);
+
+        for (child_idx = 0; child_idx < node->child_num; child_idx++) {
+
+            child = &img->node_list[node->first_child + child_idx];
+            rec_len = entry_len(img, child);
+            ext_num = extent_num(img, child);
+
+            if (is_rr && rr_has_ce(child)) {
+                put_rr_text(dir_data + node->dir_size + child->ce_pos, child);
+            }
+
+            for (ext_idx = 0; ext_idx < ext_num; ext_idx++) {
+
+                if (pos % GEN_SECTOR + rec_len > GEN_SECTOR) {
+                    pos += GEN_SECTOR - pos % GEN_SECTOR;
+                }
+
+                if (child->is_dir) {
+                    put_record(dir_data + pos, child->lba, child->dir_size,
+                                true, false, child->name, child->name_len,
+                                char_size);
+                } else if (ext_num == 1) {
+                    put_record(dir_data + pos, child->size ? child->lba : 0,
+                                data_len(img, child), false, false,
+                                child->name, child->name_len, char_size);
+                } else {
+                    remain = child->size -
+                                (uint64_t) ext_idx * img->shape->extent_size;
+                    put_record(dir_data + pos, child->lba + ext_idx *
+                                    (img->shape->extent_size / GEN_SECTOR),
+                                remain < img->shape->extent_size ?
+                                    remain : img->shape->extent_size,
+                                false, ext_idx + 1 < ext_num, child->name,
+                                child->name_len, char_size);
+                }
+
+                if (is_rr) {
+                    put_susp(dir_data + pos, child, node->lba +
+                                node->dir_size / GEN_SECTOR);
+                }
+                pos += rec_len;
+            }
+        }
+
+        if (!write_at(fd, dir_data, node->dir_size + node->ce_size,
+                        (off_t) node->lba * GEN_SECTOR)) {
+            goto exit_normal;
+        }
+
+        free(dir_data);
+        dir_data = NULL;
+    }
+
+    // File contents are written so reads hit real pages, not holes
+    fill = malloc(GEN_FILL_CHUNK);
+    if (fill == NULL) {
+        goto exit_normal;
+    }
+    gen_fill(fill, 0, GEN_FILL_CHUNK);
+
+    for (node_idx = 0; node_idx < img->node_num; node_idx++) {
+
+        node = &img->node_list[node_idx];
+        if (node->is_dir || node->size == 0) {
+            continue;
+        }
+
+        offset = (uint64_t) node->lba * GEN_SECTOR;
+        if (img->shape->zisofs) {
+            if (!write_at(fd, img->ziso_data, img->ziso_len, offset)) {
+                goto exit_normal;
+            }
+            continue;
+        }
+
+        for (remain = node->size; remain > 0; remain -= chunk) {
+            chunk = remain < GEN_FILL_CHUNK ? remain : GEN_FILL_CHUNK;
+            if (!write_at(fd, fill, chunk, offset)) {
+                goto exit_normal;
+            }
+            offset += chunk;
+        }
+    }
+
+    is_ok = true;
+    exit_normal:
+        free(fill);
+        free(dir_data);
+        free(pt_data);
+        return is_ok;
+}
+
+// One zisofs stream serves every file, since their contents are the same
+static
+bool gen_ziso(gen_image_t *img) {
+
+    uint8_t *raw;
+    uLongf dest_len;
+    uint64_t size;
+    uint32_t block_num, block_idx, block_size, pos, len;
+    size_t bound;
+    bool is_ok;
+
+    is_ok = false;
+    size = img->shape->file_size;
+    block_size = 1U << GEN_ZISO_LOG2;
+    block_num = (size + block_size - 1) / block_size;
+
+    bound = ZISO_HEADER_SIZE + 4 * (block_num + 1) +
+                (size_t) block_num * compressBound(block_size);
+    img->ziso_data = calloc(1, bound);
+    raw = malloc(block_size);
+    if (img->ziso_data == NULL || raw == NULL) {
+        goto exit_normal;
+    }
+
+    // Header, then a pointer per block plus one past the last
+    memcpy(img->ziso_data, ZISO_MAGIC, 8);
+    put_le32(img->ziso_data + 8, size);
+    img->ziso_data[12] = ZISO_HEADER_SIZE / 4;
+    img->ziso_data[13] = GEN_ZISO_LOG2;
+
+    pos = ZISO_HEADER_SIZE + 4 * (block_num + 1);
+    for (block_idx = 0; block_idx < block_num; block_idx++) {
+
+        put_le32(img->ziso_data + ZISO_HEADER_SIZE + 4 * block_idx, pos);
+
+        len = (size - (uint64_t) block_idx * block_size < block_size) ?
+                size - (uint64_t) block_idx * block_size : block_size;
+        gen_fill(raw, (uint64_t) block_idx * block_size, len);
+
+        dest_len = bound - pos;
+        if (compress2(img->ziso_data + pos, &dest_len, raw, len, 9) != Z_OK) {
+            goto exit_normal;
+        }
+        pos += dest_len;
+    }
+    put_le32(img->ziso_data + ZISO_HEADER_SIZE + 4 * block_num, pos);
+    img->ziso_len = pos;
+
+    is_ok = true;
+    exit_normal:
+        free(raw);
+        return is_ok;
+}
+
+bool gen_image(gen_shape_t *shape, char *path) {
+
+    gen_image_t img;
+    bool is_ok;
+    int fd;
+
+    memset(&img, 0, sizeof(img));
+    img.shape = shape;
+    is_ok = false;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        return false;
+    }
+
+    if (gen_tree(&img) && (!shape->zisofs || gen_ziso(&img))) {
+        gen_layout(&img);
+        is_ok = gen_write(&img, fd);
+    }
+
+    free(img.ziso_data);
+    free(img.node_list);
+    close(fd);
+    return is_ok;
+}
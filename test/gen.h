@@ -0,0 +1,67 @@
+#ifndef ISO_MINI_GEN_H
+#define ISO_MINI_GEN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define GEN_SECTOR 0x800
+#define GEN_NAME_MAX 64
+
+// zisofs shapes compress files in 32 KiB blocks
+#define GEN_ZISO_LOG2 15
+
+typedef struct {
+    char *name;
+    uint32_t depth;
+    uint32_t dirs_per_dir;
+    uint32_t files_per_dir;
+    uint64_t file_size;
+    uint32_t extent_size;
+    bool long_names;
+    bool prefix_names;
+    bool rock_ridge;
+    bool zisofs;
+} gen_shape_t;
+
+typedef struct {
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t child_num;
+    uint32_t depth;
+
+    bool is_dir;
+    uint32_t dir_num;
+    uint64_t size;
+
+    uint16_t name[GEN_NAME_MAX];
+    uint8_t name_len;
+    uint32_t seq;
+
+    uint32_t lba;
+    uint32_t dir_size;
+
+    // Rock Ridge only: a child's place in its parent's continuation
+    // area, and for directories the size of that area
+    uint32_t ce_pos;
+    uint32_t ce_size;
+} gen_node_t;
+
+// Writes a Joliet image (Rock Ridge if the shape asks) to path
+bool gen_image(gen_shape_t *shape, char *path);
+
+// Every file holds the same bytes, cut to its size; zisofs files once
+// inflated
+void gen_fill(uint8_t *dst, uint64_t offset, size_t length);
+
+// Rock Ridge attributes derive from the entry's sequence number alone, so
+// callers can check them against the record's name
+bool rr_is_link(gen_node_t *node);
+
+uint32_t rr_name(gen_node_t *node, char *dst);
+
+uint32_t rr_link(gen_node_t *node, char *dst);
+
+void rr_px(gen_node_t *node, uint32_t *px);
+
+#endif
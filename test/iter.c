@@ -1,29 +1,19 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "iso.h"
 
-int my_callback(imn_record_t *rec, void *unused) {
+int my_callback(imn_record_t *rec, char *path, size_t path_len,
+        void *unused) {
 
-    imn_error_t ret_val;
-    char *buffer;
-
-    if (rec == NULL) {
-        return -1;
-    }
-
-    buffer = malloc(4096);
-    if (buffer == NULL) {
-        return -1;
-    }
-
-    ret_val = imn_get_path(rec, buffer, 4096);
-    if (ret_val != IMN_OK) {
+    if (rec == NULL || path == NULL) {
         return -1;
     }
 
-    printf("%s\n", buffer);
+    fwrite(path, 1, path_len, stdout);
+    putchar('\n');
     return 0;
 }
 
@@ -31,13 +21,21 @@ int main(int argc, char *argv[]) {
 
     imn_error_t ret_val;
     imn_iso_t iso;
-    imn_callback_t cb;
+    imn_path_callback_t cb;
+    bool use_mmap;
 
-    if (argc != 2) {
-        printf("Usage: %s ISO-FILE\n", argv[0]);
+    use_mmap = (argc == 3 && strcmp(argv[1], "-m") == 0);
+
+    if (argc != 2 && !use_mmap) {
+        printf("Usage: %s [-m] ISO-FILE\n", argv[0]);
+        return EXIT_FAILURE;
     }
     
-    ret_val = imn_init(&iso, argv[1], true);
+    if (use_mmap) {
+        ret_val = imn_init_mmap(&iso, argv[2], true);
+    } else {
+        ret_val = imn_init(&iso, argv[1], true);
+    }
     if (ret_val != IMN_OK) {
         printf("ERROR NUM: %d\n", ret_val);
         return EXIT_FAILURE;
@@ -46,7 +44,8 @@ int main(int argc, char *argv[]) {
     cb.fn = my_callback;
     cb.args = NULL;
 
-    ret_val = imn_traverse_dir(&iso, iso.desc->root_dir, &cb, true);
+    ret_val = imn_traverse_paths(&iso, iso.desc->root_dir, &cb, true);
+    imn_close(&iso);
     if (ret_val != IMN_OK) {
         printf("ERROR NUM: %d\n", ret_val);
         return EXIT_FAILURE;
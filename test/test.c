@@ -0,0 +1,817 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "iso.h"
+#include "gen.h"
+
+#define TEST_PATH_MAX 0x1000
+#define TEST_LINE_MAX (TEST_PATH_MAX + 32)
+#define TEST_THREADS 4
+
+// Odd-sized reads straddle sectors and zisofs blocks
+#define TEST_READ_CHUNK 1000
+
+// Small enough that one walk of the tree image must evict
+#define TEST_CACHE_SLOTS 2
+#define TEST_BATCH_CAP 3
+
+/**** Image shapes ****/
+
+static gen_shape_t shape_list[] = {
+    // name      depth dirs files  size      extent   long   prefix rr     ziso
+    {"tree",     2,    3,   5,     3000,     0,       false, false, false, false},
+    {"ziso",     1,    2,   3,     100000,   0,       false, false, false, true},
+};
+
+// gen_fill's bytes at each shape's file size, digested outside the library
+typedef struct {
+    uint64_t size;
+    char *sha256;
+    uint32_t crc32;
+} test_digest_t;
+
+static test_digest_t digest_list[] = {
+    {3000, "4d187201784f57a664075c86f278e3ea"
+           "0f989c59fbc836af78accbcc0486b8c2", 0x1a986ca7},
+    {100000, "5e36f5cea4f178344affaa2b16601042"
+             "2f54e15171b43f374816075d477ee60e", 0xedad9ce2},
+};
+
+/**** Listings ****/
+
+// One "path size" line per file, in the order callbacks delivered them
+typedef struct {
+    char *data;
+    size_t length;
+    size_t cap;
+    uint32_t entry_num;
+} test_log_t;
+
+typedef struct {
+    imn_iso_t *iso;
+    gen_shape_t *shape;
+    test_log_t *log;
+
+    uint8_t *expect;
+    uint8_t *buffer;
+    int out_fd;
+
+    atomic_uint seen;
+    imn_error_t error;
+} test_state_t;
+
+static
+bool log_add(test_log_t *log, char *path, uint64_t size) {
+
+    char line[TEST_LINE_MAX];
+    char *new_data;
+    int line_len;
+
+    line_len = snprintf(line, sizeof(line), "%s %lu\n", path,
+                        (unsigned long) size);
+    if (line_len < 0 || (size_t) line_len >= sizeof(line)) {
+        return false;
+    }
+
+    if (log->length + line_len + 1 > log->cap) {
+        log->cap = (log->cap ? log->cap * 2 : 0x1000) + line_len;
+        new_data = realloc(log->data, log->cap);
+        if (new_data == NULL) {
+            return false;
+        }
+        log->data = new_data;
+    }
+
+    memcpy(log->data + log->length, line, line_len + 1);
+    log->length += line_len;
+    log->entry_num++;
+    return true;
+}
+
+static
+bool log_equal(test_log_t *left, test_log_t *right) {
+    return left->entry_num == right->entry_num &&
+            left->length == right->length &&
+            (left->length == 0 ||
+             memcmp(left->data, right->data, left->length) == 0);
+}
+
+// Matches the path of a whole line, so "a/f1" does not match "b/a/f1"
+static
+bool log_has(test_log_t *log, char *path) {
+
+    char line[TEST_LINE_MAX];
+    char *found;
+
+    snprintf(line, sizeof(line), "%s ", path);
+    for (found = log->data; found != NULL &&
+            (found = strstr(found, line)) != NULL; found++) {
+        if (found == log->data || found[-1] == '\n') {
+            return true;
+        }
+    }
+    return false;
+}
+
+static
+void log_free(test_log_t *log) {
+    free(log->data);
+    memset(log, 0, sizeof(*log));
+}
+
+// The root has no path of its own; everything below it is relative
+static
+bool join_path(char *dst, char *prefix, char *name, uint32_t name_len) {
+
+    int path_len;
+
+    path_len = snprintf(dst, TEST_PATH_MAX, "%s%s%.*s", prefix,
+                        prefix[0] ? "/" : "", (int) name_len, name);
+    return path_len >= 0 && path_len < TEST_PATH_MAX;
+}
+
+static
+int log_cb(imn_record_t *rec, void *args) {
+
+    test_state_t *state;
+    char path[TEST_PATH_MAX];
+
+    state = args;
+    if (imn_get_path(rec, path, sizeof(path)) != IMN_OK ||
+            !log_add(state->log, path, rec->total_size)) {
+        return -1;
+    }
+    return 0;
+}
+
+static
+int count_cb(imn_record_t *rec, void *args) {
+
+    test_state_t *state;
+
+    state = args;
+    if (rec->is_dir) {
+        return -1;
+    }
+    atomic_fetch_add(&state->seen, 1);
+    return 0;
+}
+
+static
+int batch_cb(imn_entry_batch_t *batch, void *args) {
+
+    test_state_t *state;
+    char prefix[TEST_PATH_MAX], path[TEST_PATH_MAX];
+    uint32_t entry_idx;
+
+    state = args;
+    prefix[0] = '\0';
+    if (batch->dir_record->parent_dir != NULL &&
+            imn_get_path(batch->dir_record, prefix,
+                            sizeof(prefix)) != IMN_OK) {
+        return -1;
+    }
+
+    for (entry_idx = 0; entry_idx < batch->entry_num; entry_idx++) {
+        if (!join_path(path, prefix,
+                        batch->name_pool + batch->name_offsets[entry_idx],
+                        batch->name_lengths[entry_idx]) ||
+                !log_add(state->log, path, batch->size_list[entry_idx])) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Cursors own no copy of their directory, so subdirectories are looked up
+// again by path before descending
+static
+imn_error_t cursor_walk(imn_iso_t *iso, imn_record_t *dir_record,
+        char *prefix, test_log_t *log) {
+
+    imn_error_t ret_val;
+    imn_dir_t dir;
+    imn_record_t *entry, sub_dir;
+    char path[TEST_PATH_MAX];
+
+    ret_val = imn_dir_open(iso, dir_record, &dir);
+    if (ret_val != IMN_OK) {
+        goto exit_normal;
+    }
+
+    while ((ret_val = imn_dir_next(&dir, &entry)) == IMN_OK &&
+            entry != NULL) {
+
+        if (!join_path(path, prefix, entry->record_id, entry->id_length)) {
+            ret_val = IMN_PATH_ERR;
+            break;
+        }
+
+        if (!entry->is_dir) {
+            if (!log_add(log, path, entry->total_size)) {
+                ret_val = IMN_ALLOC_ERR;
+                break;
+            }
+            continue;
+        }
+
+        ret_val = imn_lookup(iso, path, &sub_dir);
+        if (ret_val != IMN_OK) {
+            break;
+        }
+        ret_val = cursor_walk(iso, &sub_dir, path, log);
+        imn_free_record(&sub_dir);
+        if (ret_val != IMN_OK) {
+            break;
+        }
+    }
+
+    imn_dir_close(&dir);
+    exit_normal:
+        return ret_val;
+}
+
+/**** Checks ****/
+
+static
+bool report(char *shape, bool use_mmap, char *test, bool is_ok) {
+    printf("%-6s %-5s %-9s %s\n", shape, use_mmap ? "mmap" : "pread", test,
+            is_ok ? "ok" : "FAILED");
+    return is_ok;
+}
+
+static
+imn_error_t open_image(imn_iso_t *iso, char *path, bool use_mmap) {
+    return use_mmap ? imn_init_mmap(iso, path, true)
+                    : imn_init(iso, path, true);
+}
+
+// Ordered callbacks must match the serial walk line for line; unordered
+// ones must at least see every file once
+static
+bool test_parallel(imn_iso_t *iso, test_log_t *serial) {
+
+    test_state_t state;
+    test_log_t log;
+    imn_callback_t cb;
+    bool is_ok;
+
+    memset(&state, 0, sizeof(state));
+    memset(&log, 0, sizeof(log));
+    state.log = &log;
+
+    cb.fn = log_cb;
+    cb.args = &state;
+    is_ok = imn_traverse_parallel(iso, iso->desc->root_dir, &cb,
+                                    TEST_THREADS, true) == IMN_OK &&
+            log_equal(&log, serial);
+
+    cb.fn = count_cb;
+    is_ok = is_ok && imn_traverse_parallel(iso, iso->desc->root_dir, &cb,
+                                            TEST_THREADS, false) == IMN_OK &&
+            atomic_load(&state.seen) == serial->entry_num;
+
+    log_free(&log);
+    return is_ok;
+}
+
+static
+bool test_batch(imn_iso_t *iso, test_log_t *serial) {
+
+    test_state_t state;
+    test_log_t log;
+    imn_entry_batch_t batch;
+    imn_batch_callback_t cb;
+    bool is_ok;
+
+    memset(&state, 0, sizeof(state));
+    memset(&log, 0, sizeof(log));
+    state.log = &log;
+
+    // A tiny batch forces flushes in the middle of a directory
+    if (imn_init_batch(&batch, TEST_BATCH_CAP, TEST_PATH_MAX) != IMN_OK) {
+        return false;
+    }
+
+    cb.fn = batch_cb;
+    cb.args = &state;
+    is_ok = imn_traverse_batch(iso, iso->desc->root_dir, &batch, &cb,
+                                true) == IMN_OK &&
+            log_equal(&log, serial);
+
+    imn_free_batch(&batch);
+    log_free(&log);
+    return is_ok;
+}
+
+static
+bool test_cursor(imn_iso_t *iso, test_log_t *serial) {
+
+    test_log_t log;
+    bool is_ok;
+
+    memset(&log, 0, sizeof(log));
+    is_ok = cursor_walk(iso, iso->desc->root_dir, "", &log) == IMN_OK &&
+            log_equal(&log, serial);
+
+    log_free(&log);
+    return is_ok;
+}
+
+// Every file of the serial walk resolves to an entry of the same size,
+// and the index's own walk finds no more and no fewer
+static
+bool check_index(imn_index_t *index, test_log_t *serial) {
+
+    test_state_t state;
+    imn_callback_t cb;
+    char path[TEST_PATH_MAX];
+    char *line;
+    unsigned long size;
+    uint32_t entry;
+
+    for (line = serial->data; line != NULL && *line != '\0';
+            line = strchr(line, '\n') + 1) {
+
+        if (sscanf(line, "%4095s %lu", path, &size) != 2 ||
+                imn_index_lookup(index, path, &entry) != IMN_OK ||
+                index->entries[entry].is_dir ||
+                index->entries[entry].total_size != size) {
+            fprintf(stderr, "index: %s does not match\n", path);
+            return false;
+        }
+    }
+
+    memset(&state, 0, sizeof(state));
+    cb.fn = count_cb;
+    cb.args = &state;
+    return imn_index_traverse(index, INDEX_ROOT, &cb, true) == IMN_OK &&
+            atomic_load(&state.seen) == serial->entry_num;
+}
+
+// Index sidecars: round trip, then staleness against another descriptor
+// of the same image and against a newer mtime
+static
+bool test_index(char *path, bool use_mmap, char *index_path,
+        test_log_t *serial) {
+
+    imn_iso_t iso;
+    imn_index_t index;
+    struct stat iso_stat;
+    struct timespec times[2];
+    uint32_t desc_idx, other_idx;
+    bool is_ok;
+
+    if (open_image(&iso, path, use_mmap) != IMN_OK) {
+        return false;
+    }
+
+    is_ok = false;
+    unlink(index_path);
+
+    if (imn_build_index(&iso, &index) != IMN_OK) {
+        goto exit_iso;
+    }
+    if (!check_index(&index, serial) ||
+            imn_save_index(&iso, &index, index_path) != IMN_OK) {
+        imn_free_index(&index);
+        goto exit_iso;
+    }
+    imn_free_index(&index);
+
+    if (imn_load_index(&iso, &index, index_path) != IMN_OK) {
+        goto exit_iso;
+    }
+    is_ok = check_index(&index, serial);
+    imn_free_index(&index);
+    if (!is_ok) {
+        goto exit_iso;
+    }
+
+    // The PVD of a Joliet image has its own (empty) tree
+    desc_idx = iso.desc->desc_idx;
+    for (other_idx = 0; other_idx < iso.desc_num; other_idx++) {
+        if (iso.desc_list[other_idx].type == DESC_TYPE_PRIMARY) {
+            break;
+        }
+    }
+
+    is_ok = other_idx < iso.desc_num && other_idx != desc_idx &&
+            imn_use_desc(&iso, other_idx) == IMN_OK &&
+            imn_load_index(&iso, &index, index_path) == IMN_STALE_ERR &&
+            imn_use_desc(&iso, desc_idx) == IMN_OK;
+    if (!is_ok) {
+        goto exit_iso;
+    }
+
+    // The handle keeps the mtime it was opened with
+    imn_close(&iso);
+    if (stat(path, &iso_stat) == -1) {
+        return false;
+    }
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = iso_stat.st_mtime + 1;
+    times[1].tv_nsec = 0;
+    if (utimensat(AT_FDCWD, path, times, 0) == -1 ||
+            open_image(&iso, path, use_mmap) != IMN_OK) {
+        return false;
+    }
+
+    is_ok = imn_load_index(&iso, &index, index_path) == IMN_STALE_ERR &&
+            imn_open_index(&iso, &index, index_path) == IMN_OK;
+    if (is_ok) {
+        is_ok = check_index(&index, serial);
+        imn_free_index(&index);
+    }
+
+    // The rebuilt sidecar is current again
+    is_ok = is_ok && imn_load_index(&iso, &index, index_path) == IMN_OK;
+    if (is_ok) {
+        imn_free_index(&index);
+    }
+
+    exit_iso:
+        imn_close(&iso);
+        unlink(index_path);
+        return is_ok;
+}
+
+// A cache too small for the tree must evict and still return the same
+// listing; a second handle on a large shared cache must hit
+static
+bool test_cache(char *path, test_log_t *serial) {
+
+    imn_iso_t iso, other;
+    imn_cache_t cache;
+    imn_cache_stats_t stats, after;
+    imn_callback_t cb;
+    test_state_t state;
+    test_log_t log;
+    bool is_ok;
+
+    memset(&state, 0, sizeof(state));
+    memset(&log, 0, sizeof(log));
+    state.log = &log;
+    cb.fn = log_cb;
+    cb.args = &state;
+    is_ok = false;
+
+    if (imn_cache_init(&cache, TEST_CACHE_SLOTS * CACHE_SLOT_SIZE) != IMN_OK) {
+        return false;
+    }
+    if (open_image(&iso, path, false) != IMN_OK) {
+        goto exit_cache;
+    }
+
+    imn_set_cache(&iso, &cache);
+    if (imn_traverse_dir(&iso, iso.desc->root_dir, &cb, true) != IMN_OK ||
+            !log_equal(&log, serial)) {
+        goto exit_iso;
+    }
+
+    log_free(&log);
+    if (imn_traverse_dir(&iso, iso.desc->root_dir, &cb, true) != IMN_OK ||
+            !log_equal(&log, serial)) {
+        goto exit_iso;
+    }
+
+    imn_cache_stats(&cache, &stats);
+    if (stats.evictions == 0 || stats.misses == 0) {
+        fprintf(stderr, "cache: %lu evictions, %lu misses\n",
+                (unsigned long) stats.evictions,
+                (unsigned long) stats.misses);
+        goto exit_iso;
+    }
+
+    imn_close(&iso);
+    imn_cache_free(&cache);
+
+    if (imn_cache_init(&cache, serial->entry_num * CACHE_SLOT_SIZE * 2) !=
+            IMN_OK) {
+        return false;
+    }
+    if (open_image(&iso, path, false) != IMN_OK) {
+        goto exit_cache;
+    }
+    if (open_image(&other, path, false) != IMN_OK) {
+        goto exit_iso;
+    }
+
+    imn_set_cache(&iso, &cache);
+    imn_set_cache(&other, &cache);
+
+    log_free(&log);
+    if (imn_traverse_dir(&iso, iso.desc->root_dir, &cb, true) == IMN_OK) {
+        imn_cache_stats(&cache, &stats);
+
+        log_free(&log);
+        is_ok = imn_traverse_dir(&other, other.desc->root_dir, &cb,
+                                    true) == IMN_OK &&
+                log_equal(&log, serial);
+
+        imn_cache_stats(&cache, &after);
+        is_ok = is_ok && after.hits > stats.hits && after.evictions == 0;
+    }
+
+    imn_close(&other);
+    exit_iso:
+        imn_close(&iso);
+    exit_cache:
+        imn_cache_free(&cache);
+        log_free(&log);
+        return is_ok;
+}
+
+// Whole files in odd-sized pieces, then one read across a block boundary;
+// zisofs files must come back inflated
+static
+int read_cb(imn_record_t *rec, void *args) {
+
+    test_state_t *state;
+    imn_file_t file;
+    size_t read_len;
+    off_t done, offset;
+
+    state = args;
+    state->error = imn_open(state->iso, rec, &file);
+    if (state->error != IMN_OK) {
+        return -1;
+    }
+
+    if ((file.ziso != NULL) != state->shape->zisofs ||
+            file.total_size != (off_t) state->shape->file_size) {
+        state->error = IMN_STD_ERR;
+        goto exit_file;
+    }
+
+    done = 0;
+    do {
+        state->error = imn_read(&file, state->buffer, TEST_READ_CHUNK,
+                                &read_len);
+        if (state->error != IMN_OK || (off_t) read_len > file.total_size -
+                done || memcmp(state->buffer, state->expect + done,
+                                read_len) != 0) {
+            state->error = IMN_STD_ERR;
+            goto exit_file;
+        }
+        done += read_len;
+    } while (read_len > 0);
+
+    offset = (1 << GEN_ZISO_LOG2) - TEST_READ_CHUNK / 2;
+    if (offset + TEST_READ_CHUNK > file.total_size) {
+        offset = file.total_size - TEST_READ_CHUNK;
+    }
+
+    state->error = imn_pread(&file, state->buffer, TEST_READ_CHUNK, offset,
+                                &read_len);
+    if (done != file.total_size || state->error != IMN_OK ||
+            read_len != TEST_READ_CHUNK ||
+            memcmp(state->buffer, state->expect + offset, read_len) != 0) {
+        state->error = IMN_STD_ERR;
+        goto exit_file;
+    }
+
+    atomic_fetch_add(&state->seen, 1);
+
+    exit_file:
+        imn_close_file(&file);
+        return (state->error == IMN_OK) ? 0 : -1;
+}
+
+static
+bool check_extract(test_state_t *state, size_t length, bool is_inflated) {
+
+    ssize_t read_len;
+
+    if (lseek(state->out_fd, 0, SEEK_CUR) != (off_t) length) {
+        return false;
+    }
+
+    read_len = pread(state->out_fd, state->buffer, length, 0);
+    if (read_len != (ssize_t) length) {
+        return false;
+    }
+
+    return is_inflated ? memcmp(state->buffer, state->expect, length) == 0
+                       : memcmp(state->buffer, ZISO_MAGIC, 8) == 0;
+}
+
+// Extraction rewinds the output file for every entry; raw zisofs output
+// is the stored stream, smaller than the file and led by its magic
+static
+int extract_cb(imn_record_t *rec, void *args) {
+
+    test_state_t *state;
+    bool is_ok;
+
+    state = args;
+    is_ok = ftruncate(state->out_fd, 0) == 0 &&
+            lseek(state->out_fd, 0, SEEK_SET) == 0 &&
+            imn_extract_to_fd(state->iso, rec, state->out_fd) == IMN_OK &&
+            check_extract(state, state->shape->file_size, true);
+
+    if (is_ok && state->shape->zisofs) {
+        is_ok = ftruncate(state->out_fd, 0) == 0 &&
+                lseek(state->out_fd, 0, SEEK_SET) == 0 &&
+                imn_extract_raw_to_fd(state->iso, rec,
+                                        state->out_fd) == IMN_OK &&
+                rec->total_size < (off_t) state->shape->file_size &&
+                check_extract(state, rec->total_size, false);
+    }
+
+    if (!is_ok) {
+        state->error = IMN_STD_ERR;
+        return -1;
+    }
+
+    atomic_fetch_add(&state->seen, 1);
+    return 0;
+}
+
+static
+int hash_cb(imn_hash_result_t *result, void *args) {
+
+    test_state_t *state;
+    test_digest_t *digest;
+    char hex[2 * SHA256_DIGEST_SIZE + 1];
+    uint32_t digest_idx, byte_idx;
+
+    state = args;
+
+    digest = NULL;
+    for (digest_idx = 0; digest_idx < sizeof(digest_list) /
+                                        sizeof(digest_list[0]); digest_idx++) {
+        if (digest_list[digest_idx].size == state->shape->file_size) {
+            digest = &digest_list[digest_idx];
+        }
+    }
+
+    for (byte_idx = 0; byte_idx < SHA256_DIGEST_SIZE; byte_idx++) {
+        snprintf(hex + 2 * byte_idx, 3, "%02x", result->sha256[byte_idx]);
+    }
+
+    if (digest == NULL || result->size != (off_t) digest->size ||
+            result->crc32 != digest->crc32 ||
+            strcmp(hex, digest->sha256) != 0 ||
+            !log_has(state->log, result->path)) {
+        fprintf(stderr, "hash: %s %s %08x does not match\n", result->path,
+                hex, result->crc32);
+        return -1;
+    }
+
+    atomic_fetch_add(&state->seen, 1);
+    return 0;
+}
+
+static
+bool run_files(imn_iso_t *iso, test_state_t *state,
+        int (*fn)(imn_record_t *, void *)) {
+
+    imn_callback_t cb;
+
+    cb.fn = fn;
+    cb.args = state;
+    atomic_store(&state->seen, 0);
+    state->error = IMN_OK;
+
+    return imn_traverse_dir(iso, iso->desc->root_dir, &cb, true) == IMN_OK &&
+            atomic_load(&state->seen) == state->log->entry_num;
+}
+
+static
+bool test_hash(imn_iso_t *iso, test_state_t *state) {
+
+    imn_hash_callback_t cb;
+
+    cb.fn = hash_cb;
+    cb.args = state;
+    atomic_store(&state->seen, 0);
+
+    return imn_hash_all(iso, iso->desc->root_dir, HASH_SHA256 | HASH_CRC32,
+                        &cb, TEST_THREADS) == IMN_OK &&
+            atomic_load(&state->seen) == state->log->entry_num;
+}
+
+static
+bool run_shape(gen_shape_t *shape, char *path, char *index_path,
+        int out_fd, bool use_mmap) {
+
+    imn_iso_t iso;
+    test_log_t serial;
+    test_state_t state;
+    imn_callback_t cb;
+    bool is_ok;
+
+    memset(&serial, 0, sizeof(serial));
+    memset(&state, 0, sizeof(state));
+
+    if (open_image(&iso, path, use_mmap) != IMN_OK) {
+        fprintf(stderr, "%s: init failed\n", shape->name);
+        return false;
+    }
+
+    state.iso = &iso;
+    state.shape = shape;
+    state.log = &serial;
+    state.out_fd = out_fd;
+    state.expect = malloc(shape->file_size);
+    state.buffer = malloc(shape->file_size + TEST_READ_CHUNK);
+    if (state.expect == NULL || state.buffer == NULL) {
+        is_ok = false;
+        goto exit_iso;
+    }
+    gen_fill(state.expect, 0, shape->file_size);
+
+    // The serial walk is the reference every other listing must match
+    cb.fn = log_cb;
+    cb.args = &state;
+    is_ok = report(shape->name, use_mmap, "traverse",
+                    imn_traverse_dir(&iso, iso.desc->root_dir, &cb,
+                                        true) == IMN_OK &&
+                    serial.entry_num > 0);
+    if (!is_ok) {
+        goto exit_iso;
+    }
+
+    is_ok &= report(shape->name, use_mmap, "parallel",
+                    test_parallel(&iso, &serial));
+    is_ok &= report(shape->name, use_mmap, "batch",
+                    test_batch(&iso, &serial));
+    is_ok &= report(shape->name, use_mmap, "cursor",
+                    test_cursor(&iso, &serial));
+    is_ok &= report(shape->name, use_mmap, "read",
+                    run_files(&iso, &state, read_cb));
+    is_ok &= report(shape->name, use_mmap, "extract",
+                    run_files(&iso, &state, extract_cb));
+    is_ok &= report(shape->name, use_mmap, "hash",
+                    test_hash(&iso, &state));
+    is_ok &= report(shape->name, use_mmap, "index",
+                    test_index(path, use_mmap, index_path, &serial));
+    // Mapped handles read directory blocks in place, never through a cache
+    if (!use_mmap) {
+        is_ok &= report(shape->name, use_mmap, "cache",
+                        test_cache(path, &serial));
+    }
+
+    exit_iso:
+        free(state.expect);
+        free(state.buffer);
+        log_free(&serial);
+        imn_close(&iso);
+        return is_ok;
+}
+
+int main(void) {
+
+    char path[] = "/tmp/iso_test_XXXXXX";
+    char out_path[] = "/tmp/iso_test_out_XXXXXX";
+    char index_path[sizeof(path) + 4];
+    size_t shape_idx;
+    int fd, out_fd, use_mmap;
+    bool is_ok;
+
+    fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+
+    out_fd = mkstemp(out_path);
+    if (out_fd == -1) {
+        perror("mkstemp");
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    is_ok = true;
+    for (shape_idx = 0; shape_idx < sizeof(shape_list) /
+                                    sizeof(shape_list[0]); shape_idx++) {
+
+        if (!gen_image(&shape_list[shape_idx], path)) {
+            fprintf(stderr, "%s: could not write %s\n",
+                    shape_list[shape_idx].name, path);
+            is_ok = false;
+            continue;
+        }
+
+        for (use_mmap = 0; use_mmap < 2; use_mmap++) {
+            if (!run_shape(&shape_list[shape_idx], path, index_path, out_fd,
+                            use_mmap)) {
+                is_ok = false;
+            }
+        }
+    }
+
+    close(out_fd);
+    unlink(out_path);
+    unlink(path);
+    return is_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}